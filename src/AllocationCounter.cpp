@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "AllocationCounter.h"
+
+#ifdef DEBUG_COUNT_ALLOCATIONS
+static std::atomic<uint64_t> allocations(0);
+static thread_local uint64_t thread_allocations = 0;
+static thread_local int exempt_depth = 0;
+
+void* operator new(std::size_t size)
+{
+    if (exempt_depth == 0)
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        thread_allocations++;
+    }
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+#endif
+
+bool AllocationCounter::enabled()
+{
+    #ifdef DEBUG_COUNT_ALLOCATIONS
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+uint64_t AllocationCounter::count()
+{
+    #ifdef DEBUG_COUNT_ALLOCATIONS
+    return allocations.load(std::memory_order_relaxed);
+    #else
+    return 0;
+    #endif
+}
+
+uint64_t AllocationCounter::threadCount()
+{
+    #ifdef DEBUG_COUNT_ALLOCATIONS
+    return thread_allocations;
+    #else
+    return 0;
+    #endif
+}
+
+void AllocationCounter::checkRound(const char* scope, int round, uint64_t allocations)
+{
+    if (!enabled() || round < WarmupRounds || allocations == 0)
+        return;
+
+    // Warning of one thread must not show up in the round of another
+    Exempt warning;
+    Log::log(LogLevel::WARNING, "Steady state round " + std::to_string(round) + " allocated " + std::to_string(allocations) + " time(s)", scope);
+}
+
+AllocationCounter::Exempt::Exempt()
+{
+    #ifdef DEBUG_COUNT_ALLOCATIONS
+    exempt_depth++;
+    #endif
+}
+
+AllocationCounter::Exempt::~Exempt()
+{
+    #ifdef DEBUG_COUNT_ALLOCATIONS
+    exempt_depth--;
+    #endif
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "Config.h"
+#include "Log.h"
+
+/*
+Counts heap allocations (operator new) of the whole process and of each thread, enabled by DEBUG_COUNT_ALLOCATIONS in Config.h.
+The Batcher and the inference servers use it to verify that simulation rounds in steady state do not allocate,
+every round after the warm up that still allocates is logged as a warning.
+Memory growing with the tree and allocations inside of libtorch are expected, they are exempted where they happen.
+Without the define, global operator new stays untouched and the count is always 0.
+*/
+
+class AllocationCounter
+{
+public:
+    static bool enabled();
+    static uint64_t count();
+    // Allocations of the calling thread only, for work running next to other threads
+    static uint64_t threadCount();
+    // Warns if a round past the warm up allocated, rounds count from 0
+    static void checkRound(const char* scope, int round, uint64_t allocations);
+
+    // Rounds growing buffers to their steady size
+    static constexpr int WarmupRounds = 2;
+
+    // Allocations of the calling thread are not counted while one exists
+    struct Exempt
+    {
+        Exempt();
+        ~Exempt();
+    };
+
+    // Prevent instantiation
+    AllocationCounter() = delete;
+};
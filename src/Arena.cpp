@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "Arena.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Slots are aligned so no object ever straddles a cache line needlessly
+static constexpr size_t slot_alignment = 16;
+
+Arena::Arena(bool huge_pages)
+    : huge_pages(huge_pages)
+{   }
+
+Arena::~Arena()
+{
+    // Bulk release, objects are expected to be destroyed already
+    for (std::tuple<void*, bool> chunk : chunks)
+    {
+#ifdef __linux__
+        if (std::get<1>(chunk))
+        {
+            munmap(std::get<0>(chunk), ArenaChunkSize);
+            continue;
+        }
+#endif
+        std::free(std::get<0>(chunk));
+    }
+}
+
+void* Arena::allocateChunk()
+{
+    void* chunk = nullptr;
+    bool mapped = false;
+
+#ifdef __linux__
+    if (huge_pages)
+    {
+        // Explicit huge pages first, fall back to transparent ones if none are reserved
+        chunk = mmap(nullptr, ArenaChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (chunk == MAP_FAILED)
+        {
+            chunk = mmap(nullptr, ArenaChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk != MAP_FAILED)
+                madvise(chunk, ArenaChunkSize, MADV_HUGEPAGE);
+        }
+
+        if (chunk == MAP_FAILED)
+            chunk = nullptr;
+        else
+            mapped = true;
+    }
+#endif
+
+    if (chunk == nullptr)
+        chunk = std::aligned_alloc(slot_alignment, ArenaChunkSize);
+
+    if (chunk == nullptr)
+    {
+        Log::log(LogLevel::FATAL, "Failed to allocate arena chunk", "ARENA");
+        throw std::bad_alloc();
+    }
+
+    chunks.push_back(std::tuple<void*, bool>(chunk, mapped));
+    return chunk;
+}
+
+ArenaSlab& Arena::getSlab(size_t size)
+{
+    size_t slot_size = (size + slot_alignment - 1) / slot_alignment * slot_alignment;
+
+    // Only a handful of object types live in an arena
+    for (ArenaSlab& slab : slabs)
+        if (slab.slot_size == slot_size)
+            return slab;
+
+    slabs.push_back(ArenaSlab{slot_size, nullptr, nullptr, nullptr});
+    return slabs.back();
+}
+
+void* Arena::allocate(size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    if (Config::treeParallel())
+        lock.lock();
+
+    ArenaSlab& slab = getSlab(size);
+
+    // Reuse freed slot
+    if (slab.free_list)
+    {
+        void* slot = slab.free_list;
+        slab.free_list = *static_cast<void**>(slot);
+        return slot;
+    }
+
+    if (slab.cursor == nullptr || slab.cursor + slab.slot_size > slab.end)
+    {
+        slab.cursor = static_cast<char*>(allocateChunk());
+        slab.end = slab.cursor + ArenaChunkSize;
+    }
+
+    void* slot = slab.cursor;
+    slab.cursor += slab.slot_size;
+    return slot;
+}
+
+void Arena::release(void* slot, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    if (Config::treeParallel())
+        lock.lock();
+
+    ArenaSlab& slab = getSlab(size);
+    *static_cast<void**>(slot) = slab.free_list;
+    slab.free_list = slot;
+}
+
+size_t Arena::getReservedBytes()
+{
+    return chunks.size() * ArenaChunkSize;
+}
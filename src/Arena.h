@@ -0,0 +1,65 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "Config.h"
+#include "Log.h"
+
+/*
+Slab allocator owned by a single Tree, holds all Nodes, States and NodeData of that tree.
+Memory is taken from large chunks (optionally backed by huge pages) and objects are
+carved out with one slab per object size, freed slots are reused through a free list.
+
+All chunks are released at once when the arena is destroyed.
+Only locks in tree parallel search (Config::treeParallel), otherwise every tree is only ever worked on by one thread.
+*/
+
+struct ArenaSlab
+{
+    size_t slot_size;
+    // Intrusive list of freed slots
+    void* free_list;
+    // Bump region of the newest chunk
+    char* cursor;
+    char* end;
+};
+
+class Arena
+{
+public:
+    Arena(bool huge_pages);
+    ~Arena();
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    void destroy(T* object)
+    {
+        if (object == nullptr)
+            return;
+        object->~T();
+        release(object, sizeof(T));
+    }
+
+    // Bytes taken from the system
+    size_t getReservedBytes();
+
+private:
+    void* allocate(size_t size);
+    void release(void* slot, size_t size);
+    ArenaSlab& getSlab(size_t size);
+    void* allocateChunk();
+
+    bool huge_pages;
+    std::mutex mutex;
+    std::vector<ArenaSlab> slabs;
+    // Chunk and if it was mapped directly
+    std::vector<std::tuple<void*, bool>> chunks;
+};
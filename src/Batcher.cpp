@@ -5,7 +5,7 @@
 #include "Batcher.h"
 
 Batcher::Batcher(int environment_count, Model* NNB, Model* NNW)
-    : gcp_data(nullptr), sim_data(nullptr), tree_viz_id(0) {
+    : eval_cache(nullptr), inference_servers{nullptr, nullptr}, pool(nullptr), network_cohort(IdleCohort), tree_viz_id(0) {
     if (Config::seed() != -1)
         rng = new std::mt19937(Config::seed());
     else
@@ -19,13 +19,17 @@ Batcher::Batcher(int environment_count, Model* NNB, Model* NNW)
     non_terminal_environments.reserve(environment_count);
 
     for (int i = 0; i < environment_count; i++) {
-        Environment* env = new Environment(true);
+        // Seeded from the batchers rng, so seeded runs repeat without every env getting the same noise
+        Environment* env = new Environment(true, (*rng)());
         environments.push_back(env);
 
         // new envs are assumed non terminal
         non_terminal_environments.push_back(env);
     }
 
+    if (Config::evalCacheSize() > 0)
+        eval_cache = new EvaluationCache(Config::evalCacheSize());
+
     // Threading init
     init_threads();
 
@@ -36,7 +40,7 @@ Batcher::Batcher(int environment_count, Model* NNB, Model* NNW)
 }
 
 Batcher::Batcher(int environment_count, Model* only_model)
-    : gcp_data(nullptr), sim_data(nullptr), tree_viz_id(0) {
+    : eval_cache(nullptr), inference_servers{nullptr, nullptr}, pool(nullptr), network_cohort(IdleCohort), tree_viz_id(0) {
     if (Config::seed() != -1)
         rng = new std::mt19937(Config::seed());
     else
@@ -51,13 +55,16 @@ Batcher::Batcher(int environment_count, Model* only_model)
 
     // Super simple, needs randomization for inital gamestates
     for (int i = 0; i < environment_count; i++) {
-        Environment* env = new Environment(false);
+        Environment* env = new Environment(false, (*rng)());
         environments.push_back(env);
 
         // new envs are assumed non terminal
         non_terminal_environments.push_back(env);
     }
 
+    if (Config::evalCacheSize() > 0)
+        eval_cache = new EvaluationCache(Config::evalCacheSize());
+
     // Threading init
     init_threads();
 
@@ -70,125 +77,36 @@ Batcher::Batcher(int environment_count, Model* only_model)
 Batcher::~Batcher() {
     Log::log(LogLevel::INFO, "Started deconstructing batcher", "BATCHER");
 
-    for (Environment* env : environments)
-        delete env;
-
-    // Call to threads to finish
-    for (int i = 0; i < static_cast<int>(gcp.size()); i++) {
-        gcp_data->running[i]->store(false);
-        gcp_data->cv[i]->notify_one();
+    if (network_thread.joinable())
+    {
+        network_cohort.store(StopCohort);
+        network_cohort.notify_all();
+        network_thread.join();
     }
 
-    for (int i = 0; i < static_cast<int>(sim.size()); i++) {
-        sim_data->running[i]->store(false);
-        sim_data->cv[i]->notify_one();
-    }
+    for (Environment* env : environments)
+        delete env;
 
-    // Join all threads
-    // Todo Better solution
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // Joins all workers
+    delete pool;
 
-    // Delete threading data
-    if (gcp_data)
-        delete gcp_data;
+    for (InferenceServer* server : inference_servers)
+        delete server;
 
-    if (sim_data)
-        delete sim_data;
+    if (eval_cache)
+        delete eval_cache;
 
     Log::log(LogLevel::INFO, "Finished deconstructing batcher", "BATCHER");
 }
 
 void Batcher::init_threads() {
-    int gcp_threads = std::max(1,
-        std::min(
-            Config::maxThreads(),
-            static_cast<int>(environments.size() /
-            Config::gamestatesPerThread())));
-
-    int sim_threads = std::max(1,
-        std::min(
-            Config::maxThreads(),
-            static_cast<int>(environments.size()) /
-            Config::simsPerThread()));
-
-    if (gcp_threads > 1) {
-        start_gcp(gcp_threads);
-    }
-
-    if (sim_threads > 1) {
-        start_sim(sim_threads);
-    }
-}
-
-void Batcher::gcp_worker(GCPData* data, int id) {
-    std::unique_lock<std::mutex> lock(*data->mutex[id]);
-
-    while (data->running[id]->load()) {
-        // Wait for signal from thread manager
-        data->cv[id]->wait(lock, [&]() { return data->waits[id]->load(); });
-
-        const int loop_start = data->starts[id]->load();
-        const int loop_end = data->ends[id]->load();
-        for (int i = loop_start; i < loop_end; i++) {
-            (*data->target)[i] =
-                Node::nodeToGamestate((*data->input)[i], data->dtype);
-        }
-        data->waits[id]->store(false);
-
-        // Singal that worker is finished
-        {
-            std::lock_guard<std::mutex> finishLock(*data->finished_mutex);
-            data->finished_cv->notify_one();
-        }
-    }
-}
+    // The thread submitting work runs tasks as well
+    pool = new ThreadPool(Config::maxThreads() - 1);
 
-void Batcher::sim_worker(SIMData* data, int id) {
-    std::unique_lock<std::mutex> lock(*data->mutex[id]);
-
-    while (data->running[id]->load()) {
-        // Wait for signal from thread manager
-        data->cv[id]->wait(lock, [&]() { return data->waits[id]->load(); });
-
-        const int loop_start = data->starts[id]->load();
-        const int loop_end = data->ends[id]->load();
-        for (int i = loop_start; i < loop_end; i++) {
-            runPolicy((*data->input)[i]);
-        }
-        data->waits[id]->store(false);
-
-        // Singal that worker is finished
-        {
-            std::lock_guard<std::mutex> finishLock(*data->finished_mutex);
-            data->finished_cv->notify_one();
-        }
-    }
-}
-
-void Batcher::start_gcp(int threads)
-{
-    gcp_data = new GCPData(threads);
-
-    for (int i = 0; i < threads; i++)
-    {
-        std::thread* worker = new std::thread(gcp_worker, gcp_data, i);
-        gcp.push_back(worker);
-    }
-
-    Log::log(LogLevel::INFO, "Started " + std::to_string(threads) + " GCP thread(s)", "BATCHER");
-}
-
-void Batcher::start_sim(int threads)
-{
-    sim_data = new SIMData(threads);
-
-    for (int i = 0; i < threads; i++)
-    {
-        std::thread* worker = new std::thread(sim_worker, sim_data, i);
-        sim.push_back(worker);
-    }
-
-    Log::log(LogLevel::INFO, "Started " + std::to_string(threads) + " SIM thread(s)", "BATCHER");
+    // Every model call goes through the models server
+    for (int i = 0; i < 2; i++)
+        if (models[i] != nullptr)
+            inference_servers[i] = new InferenceServer(models[i]);
 }
 
 bool Batcher::getNextModelIndex(Environment* env)
@@ -222,228 +140,533 @@ bool Batcher::isTerminal()
     return false;
 }
 
-void Batcher::runPolicy(Environment* env)
+void Batcher::runPolicy(Environment* env, int leaves, int replica)
 {
-    Node* selected = env->policy();
-    // If node already with netdata implies it didnt get backpropagated so we manually call it again
-    if (selected->getNetworkStatus())
-        selected->callBackpropagate();
+    // Tree backpropagates leafs which already have netdata itself
+    for (int i = 0; i < leaves; i++)
+        env->policy(leaves > 1, replica);
 }
 
 void Batcher::updateNonTerminal()
 {
-    std::vector<Environment*> new_non_terminal;
+    // Filter in place, order stays the same
+    size_t previous_count = non_terminal_environments.size();
+    size_t count = 0;
     for (Environment* env : non_terminal_environments)
     {
         if (!env->isTerminal())
-            new_non_terminal.push_back(env);
+            non_terminal_environments[count++] = env;
         else
             env->collapseEnvironment();
     }
+    non_terminal_environments.resize(count);
 
-    if (new_non_terminal.size() != non_terminal_environments.size())
-        Log::log(LogLevel::INFO, "Updated non terminal envs from " + std::to_string(non_terminal_environments.size()) + " to " + std::to_string(new_non_terminal.size()), "BATCHER");
-
-    non_terminal_environments = new_non_terminal;
+    if (count != previous_count)
+        Log::log(LogLevel::INFO, "Updated non terminal envs from " + std::to_string(previous_count) + " to " + std::to_string(count), "BATCHER");
 }
 
 void Batcher::runNetwork()
+{
+    runNetwork(&non_terminal_environments);
+}
+
+void NetworkEvaluation::reset(size_t env_count)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        unique_nodes[i].clear();
+        unique_hashes[i].clear();
+        model_outputs[i].clear();
+        outputs[i].clear();
+        std::fill(unique_table[i].begin(), unique_table[i].end(), -1);
+    }
+    cached.clear();
+
+    // Never shrinks, so the buffer of every env keeps its memory
+    if (env_outputs.size() < env_count)
+        env_outputs.resize(env_count);
+    for (size_t i = 0; i < env_count; i++)
+        env_outputs[i].clear();
+}
+
+void NetworkEvaluation::reserve(size_t env_count, size_t env_rows)
+{
+    size_t rows = env_count * env_rows;
+
+    // Same bound addUnique grows the tables to
+    size_t table_size = 64;
+    while (table_size < rows * 2)
+        table_size *= 2;
+
+    for (int i = 0; i < 2; i++)
+    {
+        unique_nodes[i].reserve(rows);
+        unique_hashes[i].reserve(rows);
+        model_outputs[i].reserve(rows / Config::maxBatchsize() + 1);
+        outputs[i].reserve(rows / Config::maxBatchsize() + 1);
+        if (unique_table[i].size() < table_size)
+            unique_table[i].assign(table_size, -1);
+    }
+    // Entries hold a whole policy, only worth reserving with a cache
+    if (Config::evalCacheSize() > 0)
+        cached.reserve(rows);
+    queue.reserve(rows);
+
+    if (env_outputs.size() < env_count)
+        env_outputs.resize(env_count);
+    for (size_t i = 0; i < env_count; i++)
+        env_outputs[i].reserve(env_rows);
+}
+
+int NetworkEvaluation::findUnique(int model, uint64_t hash)
+{
+    std::vector<int>& table = unique_table[model];
+    if (table.empty())
+        return -1;
+
+    size_t mask = table.size() - 1;
+    for (size_t slot = hash & mask; table[slot] != -1; slot = (slot + 1) & mask)
+        if (unique_hashes[model][table[slot]] == hash)
+            return table[slot];
+    return -1;
+}
+
+int NetworkEvaluation::addUnique(int model, Node* node, uint64_t hash)
+{
+    int index = unique_nodes[model].size();
+    unique_nodes[model].push_back(node);
+    unique_hashes[model].push_back(hash);
+
+    auto insert = [](std::vector<int>& table, uint64_t hash, int index) {
+        size_t mask = table.size() - 1;
+        size_t slot = hash & mask;
+        while (table[slot] != -1)
+            slot = (slot + 1) & mask;
+        table[slot] = index;
+    };
+
+    // At most half full, only grows until the round sizes settle
+    std::vector<int>& table = unique_table[model];
+    if (unique_nodes[model].size() * 2 > table.size())
+    {
+        table.assign(std::max(size_t(64), table.size() * 2), -1);
+        for (int i = 0; i <= index; i++)
+            insert(table, unique_hashes[model][i], i);
+    }
+    else
+        insert(table, hash, index);
+
+    return index;
+}
+
+void Batcher::runNetwork(std::vector<Environment*>* envs, int cohort)
+{
+    NetworkEvaluation& evaluation = evaluations[cohort];
+    collectNetworkQueues(*envs, evaluation);
+    submitNetworkQueues(evaluation, nullptr, true);
+    finishNetworkQueues(*envs, evaluation, true);
+}
+
+void Batcher::collectNetworkQueues(std::span<Environment*> envs, NetworkEvaluation& evaluation)
+{
+    evaluation.reset(envs.size());
+    for (size_t env_index = 0; env_index < envs.size(); env_index++)
+    {
+        evaluation.queue.clear();
+        envs[env_index]->getNetworkQueue(evaluation.queue);
+
+        for (std::tuple<Node*, bool> queued : evaluation.queue)
+        {
+            auto [node, model_index] = queued;
+            std::vector<QueuedOutput>& env_outputs = evaluation.env_outputs[env_index];
+
+            // Save to index into models
+            Model* model = models[model_index * (models[1] != nullptr)];
+            uint64_t hash = node->getHistoryHash();
+
+            if (eval_cache)
+            {
+                evaluation.cached.emplace_back();
+                if (eval_cache->lookup(model, hash, evaluation.cached.back()))
+                {
+                    env_outputs.push_back(QueuedOutput{node, QueuedOutput::CachedOutput, int(evaluation.cached.size()) - 1, false});
+                    continue;
+                }
+                evaluation.cached.pop_back();
+            }
+
+            // Collapse positions already known
+            int unique = evaluation.findUnique(model_index, hash);
+            if (unique != -1)
+            {
+                env_outputs.push_back(QueuedOutput{node, model_index, unique, false});
+                continue;
+            }
+
+            int index = evaluation.addUnique(model_index, node, hash);
+            env_outputs.push_back(QueuedOutput{node, model_index, index, true});
+        }
+    }
+}
+
+void Batcher::submitNetworkQueues(NetworkEvaluation& evaluation, InferenceCallback* callback, bool threaded)
 {
     // Disable gradients for this scope
     torch::NoGradGuard no_grad_guard;
 
-    // Accumilate Nodes per model
-    std::vector<Node*> nodes[2];
-    for (Environment* env : non_terminal_environments)
-        for (std::tuple<Node*, bool> node : env->getNetworkQueue())
-            nodes[std::get<1>(node)].push_back(std::get<0>(node));
-
-    // Output of each model
-    std::vector<std::tuple<torch::Tensor, torch::Tensor>> model_outputs[2];
     for (int model_index = 0; model_index < 2; model_index++)
     {
-        // If no nodes, skip model call
-        if (nodes[model_index].size() == 0)
+        if (evaluation.unique_nodes[model_index].size() == 0)
             continue;
 
-        // Save to index into models
+        // If only 1 model run either case over same model
         int checked_model_index = model_index * (models[1] != nullptr);
 
-        // Maybe models with different precs
-        torch::ScalarType dtype = models[checked_model_index]->getPrec();
-        torch::Device device = models[checked_model_index]->getDevice();
-        torch::TensorOptions default_tensor_options = torch::TensorOptions().device(Config::torchHostDevice()).dtype(dtype).requires_grad(false);
+        // Maybe models with different precs, compact input is converted by the model itself
+        torch::ScalarType dtype = Config::compactInput() ? torch::kUInt8 : models[checked_model_index]->getPrec();
+        bool pinned = models[checked_model_index]->getDevice().is_cuda();
 
-        int element_count = nodes[model_index].size();
         // Compute gamestates with multithreading
-        torch::Tensor gamestates;
-        convertNodesToGamestates(gamestates, &nodes[model_index], dtype);
+        std::vector<Node*>& nodes = evaluation.unique_nodes[model_index];
+        convertNodesToGamestates(evaluation.gamestate_buffers[model_index], &nodes, dtype, pinned, threaded);
 
-        // Batchsize limiting to not explode memory
-        model_outputs[model_index].reserve(element_count / Config::maxBatchsize());
-        int processed_element_count = 0;
-        while (processed_element_count != element_count)
-        {
-            int unprocessed_count = element_count - processed_element_count;
-            int batch_size = std::min(unprocessed_count, Config::maxBatchsize());
-
-            // Convert to tensor
-            // Init tensor on CPU
-            torch::Tensor model_input = torch::empty({batch_size, Config::historyDepth() + 1, BoardSize, BoardSize}, default_tensor_options);
-            model_input = gamestates.index({torch::indexing::Slice(processed_element_count, processed_element_count + batch_size)});
-
-            // Move to device for inference
-            model_input = model_input.to(device);
-
-            // Run model
-            // If only 1 model run either case over same model
-            auto output = models[checked_model_index]->forward(model_input);
-            model_outputs[model_index].push_back(output);
-            processed_element_count += batch_size;
-        }
+        // Batchsize limiting to not explode memory is done by the server, it gets the buffer and the rows in use instead of a view
+        inference_servers[checked_model_index]->submit(evaluation.gamestate_buffers[model_index], int(nodes.size()), evaluation.model_outputs[model_index], callback);
     }
+}
 
-    // Assign output to node
+void Batcher::finishNetworkQueues(std::span<Environment*> envs, NetworkEvaluation& evaluation, bool threaded)
+{
+    // Wait for both models, every result holds consecutive rows of the unique nodes
     for (int ii = 0; ii < 2; ii++)
-    {
-        int index = 0;
-        for (std::tuple<torch::Tensor, torch::Tensor> chunk : model_outputs[ii])
-        {
-            torch::Tensor policy_data = std::get<0>(chunk);
-            torch::Tensor value_data = std::get<1>(chunk);
+        for (InferenceResult& output : evaluation.model_outputs[ii])
+            evaluation.outputs[ii].push_back(output.get());
 
-            for (int i = 0; i < policy_data.size(0); i++)
+    // Assign output to nodes, every env only backpropagates into its own trees
+    int max_batchsize = Config::maxBatchsize();
+    auto assign = [&](int begin, int end) {
+        for (int env_index = begin; env_index < end; env_index++)
+        {
+            for (QueuedOutput& queued : evaluation.env_outputs[env_index])
             {
-                nodes[ii][index]->setModelOutput(policy_data[i], value_data[i]);
-                index++;
+                // Rows are read in place from the batch output or the copied cache entry
+                const float* policy;
+                float value;
+                if (queued.source == QueuedOutput::CachedOutput)
+                {
+                    policy = evaluation.cached[queued.index].policy.data();
+                    value = evaluation.cached[queued.index].value;
+                }
+                else
+                {
+                    InferenceOutput& output = evaluation.outputs[queued.source][queued.index / max_batchsize];
+                    policy = output.policyRow(queued.index % max_batchsize);
+                    value = output.valueRow(queued.index % max_batchsize);
+                }
+                queued.node->setModelOutput(policy, value);
+
+                // Copied into the cache, so it does not keep the batch alive
+                if (eval_cache && queued.owner)
+                {
+                    Model* model = models[queued.source * (models[1] != nullptr)];
+                    eval_cache->insert(model, evaluation.unique_hashes[queued.source][queued.index], policy, value);
+                }
             }
+
+            // Clear network queue
+            bool success = envs[env_index]->clearNetworkQueue();
+            if (!success)
+                Log::log(LogLevel::WARNING, "Network queue could not be cleared (Nodes without Netdata remaining)", "BATCHER");
         }
-    }
+    };
 
-    // Clear network queue
-    for (Environment* env : non_terminal_environments)
+    if (threaded)
+        pool->parallelFor(envs.size(), Config::simsPerThread(), assign);
+    else
+        assign(0, envs.size());
+
+    // Do not keep the batch alive until the next round, the buffers keep their memory
+    for (int ii = 0; ii < 2; ii++)
     {
-        bool success = env->clearNetworkQueue();
-        if (!success)
-            Log::log(LogLevel::WARNING, "Network queue could not be cleared (Nodes without Netdata remaining)", "BATCHER");
+        evaluation.model_outputs[ii].clear();
+        evaluation.outputs[ii].clear();
     }
+    evaluation.cached.clear();
+}
+
+Batcher::NetworkAwaiter::NetworkAwaiter(Batcher* batcher, Environment* env, NetworkEvaluation& evaluation, uint64_t& allocations)
+    : batcher(batcher), env(env), evaluation(evaluation), allocations(allocations)
+{
+}
+
+bool Batcher::NetworkAwaiter::await_ready()
+{
+    uint64_t start = AllocationCounter::threadCount();
+    batcher->collectNetworkQueues(std::span<Environment*>(&env, 1), evaluation);
+    allocations += AllocationCounter::threadCount() - start;
+
+    // Only cache hits, nothing to wait for
+    return evaluation.unique_nodes[0].size() + evaluation.unique_nodes[1].size() == 0;
+}
+
+bool Batcher::NetworkAwaiter::await_suspend(SearchTask::Handle handle)
+{
+    // Submitting adds the requests of both models, so the search resumes once all its leaves are back
+    // This count holds the callback back until all results are stored
+    SearchScheduler* scheduler = handle.promise().scheduler;
+    callback.remaining.store(1);
+    callback.function = [scheduler, handle]() { scheduler->schedule(handle); };
+
+    // Already runs inside of a pool task
+    uint64_t start = AllocationCounter::threadCount();
+    batcher->submitNetworkQueues(evaluation, &callback, false);
+    allocations += AllocationCounter::threadCount() - start;
+
+    // The search can be resumed on another thread right after this
+    return callback.remaining.fetch_sub(1) != 1;
+}
+
+void Batcher::NetworkAwaiter::await_resume()
+{
+    // Already runs inside of a pool task
+    uint64_t start = AllocationCounter::threadCount();
+    batcher->finishNetworkQueues(std::span<Environment*>(&env, 1), evaluation, false);
+    allocations += AllocationCounter::threadCount() - start;
 }
 
-void Batcher::convertNodesToGamestates(torch::Tensor& target, std::vector<Node*>* nodes, torch::ScalarType dtype)
+void Batcher::convertNodesToGamestates(torch::Tensor& buffer, std::vector<Node*>* nodes, torch::ScalarType dtype, bool pinned, bool threaded)
 {
     // Disable gradients for this scope
     torch::NoGradGuard no_grad_guard;
 
     int element_count = nodes->size();
 
-    // Compute "optimal" thread count
-    int thread_count = std::max(1, element_count / Config::gamestatesPerThread());
-    thread_count = std::min(thread_count, int(gcp.size()));
+    // Grow geometrically, evaluations of one cohort or env are about the same size every round
+    // At least to the reserved unique nodes, which bound every round of a search that reserved them
+    if (!buffer.defined() || buffer.size(0) < element_count || buffer.scalar_type() != dtype)
+    {
+        int rows = std::max<int>(element_count, nodes->capacity());
+        if (buffer.defined())
+            rows = std::max<int>(rows, buffer.size(0) * 2);
+        torch::TensorOptions default_tensor_options = torch::TensorOptions().device(Config::torchHostDevice()).dtype(dtype).requires_grad(false).pinned_memory(pinned);
+        buffer = torch::empty({rows, Config::historyDepth() + 1, BoardSize, BoardSize}, default_tensor_options);
+    }
+
+    // One contiguous batch buffer, every node writes its own slice in place
+    size_t gamestate_bytes = size_t(Config::historyDepth() + 1) * BoardSize * BoardSize * c10::elementSize(dtype);
+    uint8_t* data = static_cast<uint8_t*>(buffer.data_ptr());
 
-    // Init output tensor
-    torch::TensorOptions default_tensor_options = torch::TensorOptions().device(Config::torchHostDevice()).dtype(dtype).requires_grad(false);
-    target = torch::empty({element_count, Config::historyDepth() + 1, BoardSize, BoardSize}, default_tensor_options);
+    auto convert = [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            Node::writeGamestate((*nodes)[i], data + gamestate_bytes * i, dtype);
+    };
 
-    // Use single if possible
-    if (thread_count < 2)
-    {
-        for (int i = 0; i < element_count; i++)
+    if (threaded)
+        pool->parallelFor(element_count, Config::gamestatesPerThread(), convert);
+    else
+        convert(0, element_count);
+}
+
+void Batcher::runPolicies(std::vector<Environment*>* envs, int leaves)
+{
+    // Root trees of an env are independent tasks, in tree parallel search every leaf is its own task
+    // so even a single tree keeps all threads busy
+    bool tree_parallel = Config::treeParallel() && leaves > 1;
+    int tree_tasks = tree_parallel ? leaves : 1;
+    int env_tasks = Config::rootTrees() * tree_tasks;
+
+    // Trees differ a lot in size, small tasks let idle workers steal the rest
+    int grain = env_tasks > 1 ? 1 : Config::simsPerThread();
+    pool->parallelFor(envs->size() * env_tasks, grain, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
         {
-            target[i] = Node::nodeToGamestate((*nodes)[i], dtype);
+            Environment* env = (*envs)[i / env_tasks];
+            int replica = (i % env_tasks) / tree_tasks;
+            if (tree_parallel)
+                env->policy(true, replica);
+            else
+                runPolicy(env, leaves, replica);
         }
+    });
+}
 
+void Batcher::runSimulationsOnEnvironments(std::vector<SimulationGroup>* groups)
+{
+    if (Config::coroutineSearch())
+    {
+        runCoroutineSimulations(groups);
         return;
     }
 
-    // Set params for Threading
-    gcp_data->input = nodes;
-    gcp_data->target = &target;
-    gcp_data->dtype = dtype;
+    int env_count = 0;
+    for (SimulationGroup& group : *groups)
+        env_count += group.envs.size();
 
-    // Calculate index ranges
-    int batch_size = int(std::ceil(float(element_count) / thread_count));
+    if (Config::pipeline() && env_count > 1)
+    {
+        runPipelinedSimulations(groups);
+        return;
+    }
+    reserveEvaluation(evaluations[0], groups);
 
-    // Start workers
-    for (int i = 0; i < thread_count; i++)
+    // Both stay 0 unless DEBUG_COUNT_ALLOCATIONS is set
+    uint64_t policy_allocations = 0;
+    uint64_t network_allocations = 0;
+    int rounds = 0;
+    for (int round = 0; ; round++)
     {
-        // Calc index ranges
-        int start_index = i * batch_size;
-        gcp_data->starts[i]->store(start_index);
-        gcp_data->ends[i]->store(std::min(start_index + batch_size, element_count));
-        gcp_data->waits[i]->store(true);
-        gcp_data->cv[i]->notify_one();
+        uint64_t allocations = AllocationCounter::count();
+        runPolicyRound(groups, round, round_envs[0]);
+        uint64_t policy_round = AllocationCounter::count() - allocations;
+        policy_allocations += policy_round;
+
+        if (round_envs[0].empty())
+            break;
+
+        allocations = AllocationCounter::count();
+        runNetwork(&round_envs[0]);
+        uint64_t network_round = AllocationCounter::count() - allocations;
+        network_allocations += network_round;
+        AllocationCounter::checkRound("BATCHER", round, policy_round + network_round);
+        rounds++;
     }
 
-    // Wait for workers to finish
+    if (AllocationCounter::enabled())
+        Log::log(LogLevel::INFO, "Allocations over " + std::to_string(rounds) + " round(s): " + std::to_string(policy_allocations) + " in policy, " + std::to_string(network_allocations) + " in network", "BATCHER");
+}
+
+void Batcher::runPolicyRound(std::vector<SimulationGroup>* groups, int round, std::vector<Environment*>& round_envs)
+{
+    round_envs.clear();
+    for (SimulationGroup& group : *groups)
     {
-        std::unique_lock<std::mutex> lock(*gcp_data->finished_mutex);
-        gcp_data->finished_cv->wait(lock, [&]() {
-            for (int i = 0; i < thread_count; i++) {
-                if (gcp_data->waits[i]->load()) {
-                    return false;
-                }
-            }
-            return true;
-        });
+        // Groups can differ in simulations and leaf batch, finished ones drop out
+        int sim = round * group.leaf_batch;
+        if (sim >= group.simulations)
+            continue;
+
+        runPolicies(&group.envs, std::min(group.leaf_batch, group.simulations - sim));
+        round_envs.insert(round_envs.end(), group.envs.begin(), group.envs.end());
+    }
+}
+
+void Batcher::reserveEvaluation(NetworkEvaluation& evaluation, std::vector<SimulationGroup>* groups)
+{
+    // Every round queues at most one leaf per simulation of each root tree
+    size_t env_count = 0;
+    size_t env_rows = 0;
+    for (SimulationGroup& group : *groups)
+    {
+        env_count += group.envs.size();
+        env_rows = std::max(env_rows, size_t(group.leaf_batch) * Config::rootTrees());
     }
+    evaluation.reserve(env_count, env_rows);
 }
 
-void Batcher::runSimulationsOnEnvironments(std::vector<Environment*>* envs, int simulations)
+void Batcher::runPipelinedSimulations(std::vector<SimulationGroup>* groups)
 {
-    int element_count = envs->size();
+    // Two independent cohorts, while one is in the model the other one runs its policy
+    std::vector<SimulationGroup> cohorts[2];
+    for (SimulationGroup& group : *groups)
+    {
+        for (int c = 0; c < 2; c++)
+            cohorts[c].push_back(SimulationGroup{{}, group.simulations, group.leaf_batch});
+        for (size_t i = 0; i < group.envs.size(); i++)
+            cohorts[i % 2].back().envs.push_back(group.envs[i]);
+    }
+
+    for (int c = 0; c < 2; c++)
+        reserveEvaluation(evaluations[c], &cohorts[c]);
 
-    // Compute "optimal" thread count
-    int thread_count = std::max(1, element_count / Config::simsPerThread());
-    thread_count = std::min(thread_count, int(gcp.size()));
+    // Cohort 0 leads by one policy round
+    runPolicyRound(&cohorts[0], 0, round_envs[0]);
 
-    // If thread count too low just run single threaded opperation
-    if (thread_count < 2)
+    // Both cohorts run at the same time, so a round counts the whole process
+    for (int round = 0; ; round++)
     {
-        for (int i = 0; i < simulations; i++)
-        {
-            for (Environment* env : *envs)
-            {
-                runPolicy(env);
-            }
+        uint64_t allocations = AllocationCounter::count();
+        startNetwork(0);
+        runPolicyRound(&cohorts[1], round, round_envs[1]);
+        waitNetwork();
 
-            runNetwork();
-        }
+        if (round_envs[0].empty() && round_envs[1].empty())
+            break;
 
-        return;
+        startNetwork(1);
+        runPolicyRound(&cohorts[0], round + 1, round_envs[0]);
+        waitNetwork();
+        AllocationCounter::checkRound("BATCHER", round, AllocationCounter::count() - allocations);
     }
+}
 
-    sim_data->input = envs;
+void Batcher::networkLoop()
+{
+    while (true)
+    {
+        network_cohort.wait(IdleCohort);
+        int cohort = network_cohort.load(std::memory_order_acquire);
+        if (cohort == StopCohort)
+            return;
 
-    // Calculate index ranges
-    int batch_size = int(std::ceil(float(element_count) / thread_count));
+        runNetwork(&round_envs[cohort], cohort);
 
-    for (int sim = 0; sim < simulations; sim++)
-    {
-        // Start workers
-        for (int i = 0; i < thread_count; i++)
-        {
-            // Calc index ranges
-            int start_index = i * batch_size;
-            sim_data->starts[i]->store(start_index);
-            sim_data->ends[i]->store(std::min(start_index + batch_size, element_count));
-            sim_data->waits[i]->store(true);
-            sim_data->cv[i]->notify_one();
-        }
+        network_cohort.store(IdleCohort, std::memory_order_release);
+        network_cohort.notify_all();
+    }
+}
 
-        // Wait for workers to finish
-        {
-            std::unique_lock<std::mutex> lock(*sim_data->finished_mutex);
-            sim_data->finished_cv->wait(lock, [&]() {
-                for (int i = 0; i < thread_count; i++) {
-                    if (sim_data->waits[i]->load()) {
-                        return false;
-                    }
-                }
-                return true;
-            });
-        }
+void Batcher::startNetwork(int cohort)
+{
+    if (!network_thread.joinable())
+        network_thread = std::thread(&Batcher::networkLoop, this);
 
-        runNetwork();
+    network_cohort.store(cohort, std::memory_order_release);
+    network_cohort.notify_all();
+}
+
+void Batcher::waitNetwork()
+{
+    for (int cohort = network_cohort.load(std::memory_order_acquire); cohort != IdleCohort; cohort = network_cohort.load(std::memory_order_acquire))
+        network_cohort.wait(cohort);
+}
+
+void Batcher::runCoroutineSimulations(std::vector<SimulationGroup>* groups)
+{
+    size_t search_count = 0;
+    for (SimulationGroup& group : *groups)
+        search_count += group.envs.size();
+    if (search_evaluations.size() < search_count)
+        search_evaluations.resize(search_count);
+
+    SearchScheduler scheduler;
+    size_t search = 0;
+    for (SimulationGroup& group : *groups)
+        for (Environment* env : group.envs)
+            scheduler.spawn(searchEnvironment(env, search_evaluations[search++], group.simulations, group.leaf_batch));
+
+    // Each pool thread (and this one) resumes searches until all are done
+    pool->parallelFor(pool->getWorkerCount() + 1, 1, [&](int, int) {
+        scheduler.run();
+    });
+
+    // Failures of searches surface on the calling thread instead of being lost
+    scheduler.rethrowFailure();
+}
+
+SearchTask Batcher::searchEnvironment(Environment* env, NetworkEvaluation& evaluation, int simulations, int leaf_batch)
+{
+    // Every round queues at most one leaf per simulation of each root tree
+    evaluation.reserve(1, size_t(leaf_batch) * Config::rootTrees());
+    for (int sim = 0, round = 0; sim < simulations; sim += leaf_batch, round++)
+    {
+        // Other searches run next to this one, so only allocations of the threads running it count
+        uint64_t allocations = AllocationCounter::threadCount();
+        for (int replica = 0; replica < Config::rootTrees(); replica++)
+            runPolicy(env, std::min(leaf_batch, simulations - sim), replica);
+        allocations = AllocationCounter::threadCount() - allocations;
+
+        co_await NetworkAwaiter(this, env, evaluation, allocations);
+        AllocationCounter::checkRound("BATCHER", round, allocations);
     }
 }
 
@@ -461,6 +684,7 @@ void Batcher::runSimulations()
         Log::log(LogLevel::INFO, "  " + models[1]->getName() + " on " + std::to_string(envsByModel[1].size()) + " env(s)", "BATCHER");
 
 
+    std::vector<SimulationGroup> groups;
     for (int i = 0; i < 2; i++)
     {
         if (models[i] == nullptr)
@@ -474,9 +698,11 @@ void Batcher::runSimulations()
         if (envsByModel[i].size() == 0)
             continue;
 
-        int simulations = models[i]->getSimulations();
-        runSimulationsOnEnvironments(&envsByModel[i], simulations);
+        groups.push_back(SimulationGroup{envsByModel[i], models[i]->getSimulations(), models[i]->getLeafBatch()});
     }
+
+    // Both models search in the same rounds instead of one after the other
+    runSimulationsOnEnvironments(&groups);
 }
 
 void Batcher::swapModels()
@@ -952,7 +1178,7 @@ void nodeCrawler(std::vector<Datapoint>& datapoints, Node* node, StateResult win
     {
         Datapoint data;
         data.moves = node->getMoveHistory();
-        data.best_move = node->absBestChild()->getParentAction();
+        data.best_move = node->getActionTo(node->absBestChild());
         // Change to reflect if current play won
         switch (winner)
         {
@@ -979,8 +1205,9 @@ void nodeCrawler(std::vector<Datapoint>& datapoints, Node* node, StateResult win
         datapoints.push_back(data);
     }
 
+    // Only follow owned children so shared nodes are visited once
     for (Node* child : node->children)
-        if (!child->isTerminal())
+        if (!child->isTerminal() && child->parent == node)
             nodeCrawler(datapoints, child, winner);
 }
 
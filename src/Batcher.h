@@ -12,112 +12,70 @@
 #include "Storage.h"
 #include "Log.h"
 #include "TreeVisualizer.h"
+#include "EvaluationCache.h"
+#include "ThreadPool.h"
+#include "InferenceServer.h"
+#include "SearchScheduler.h"
+#include "AllocationCounter.h"
+
+// Where a queued node gets its network output from
+struct QueuedOutput
+{
+    Node* node;
+    // Model index, CachedOutput for cache hits
+    int source;
+    // Index into unique nodes of source (or cached entries)
+    int index;
+    // Node the unique entry was created for, its output goes into the eval cache
+    bool owner;
+
+    static constexpr int CachedOutput = 2;
+};
 
-/*
-Host class for the entire selfplay.
-Automatically manages model calls and batches to improve performance wherever possible.
-Is also managing multi threading since each environment is independent from ever other one this is very easy
-*/
-
-// Data for cross thread opperations
-
-struct GCPData
+// Network queues of a set of environments on their way through the models
+// Reused between rounds, buffers only grow so a steady state round does not allocate
+struct NetworkEvaluation
 {
-    std::vector<std::atomic<int>*> starts;
-    std::vector<std::atomic<int>*> ends;
-    std::vector<std::atomic<bool>*> waits;
-    std::vector<std::atomic<bool>*> running;
-    std::vector<Node*>* input;
-
-    torch::Tensor* target;
-    torch::ScalarType dtype;
-
-    // Syncing
-    std::vector<std::mutex*> mutex;
-    std::vector<std::condition_variable*> cv;
-    std::mutex* finished_mutex;
-    std::condition_variable* finished_cv;
-
-    GCPData(int threads)
-    {
-        finished_mutex = new std::mutex();
-        finished_cv = new std::condition_variable();
-
-        for (int i = 0; i < threads; i++)
-        {
-            starts.push_back(new std::atomic<int>(0));
-            ends.push_back(new std::atomic<int>(0));
-            waits.push_back(new std::atomic<bool>(0));
-            running.push_back(new std::atomic<bool>(1));
-            mutex.push_back(new std::mutex());
-            cv.push_back(new std::condition_variable());
-        }
-    }
-
-    ~GCPData()
-    {
-        delete finished_mutex;
-        delete finished_cv;
-
-        for (int i = 0; i < int(starts.size()); i++)
-        {
-            delete starts[i];
-            delete ends[i];
-            delete waits[i];
-            delete running[i];
-            delete mutex[i];
-            delete cv[i];
-        }
-    }
+    // Nodes actually run through the model, cache hits and duplicates are resolved without it
+    std::vector<Node*> unique_nodes[2];
+    std::vector<uint64_t> unique_hashes[2];
+    // Output of each model, both models run at the same time in their servers
+    std::vector<InferenceResult> model_outputs[2];
+    // One per request, unique node i is row i % Config::maxBatchsize() of output i / Config::maxBatchsize()
+    std::vector<InferenceOutput> outputs[2];
+    std::vector<EvaluationCacheEntry> cached;
+    // Queued nodes of each env, in the order of the envs (can be longer than the current envs)
+    std::vector<std::vector<QueuedOutput>> env_outputs;
+    // Network queue of the env being collected
+    std::vector<std::tuple<Node*, bool>> queue;
+    // Open addressing index from position hash to unique node, -1 is empty
+    std::vector<int> unique_table[2];
+    // Gamestates of each model, kept for the next evaluation once the server has stacked all rows
+    torch::Tensor gamestate_buffers[2];
+
+    // Empties all buffers for env_count envs, keeps their memory
+    void reset(size_t env_count);
+    // Sizes all buffers for rounds of up to env_rows queued nodes per env, so not even the first rounds grow them
+    void reserve(size_t env_count, size_t env_rows);
+    // Index of unique node of the position, -1 if none
+    int findUnique(int model, uint64_t hash);
+    int addUnique(int model, Node* node, uint64_t hash);
 };
 
-struct SIMData
+// Environments searched with the settings of one model
+struct SimulationGroup
 {
-    std::vector<std::atomic<int>*> starts;
-    std::vector<std::atomic<int>*> ends;
-    std::vector<std::atomic<bool>*> waits;
-    std::vector<std::atomic<bool>*> running;
-    std::vector<Environment*>* input;
-
-    // Syncing
-    std::vector<std::mutex*> mutex;
-    std::vector<std::condition_variable*> cv;
-    std::mutex* finished_mutex;
-    std::condition_variable* finished_cv;
-
-    SIMData(int threads)
-    {
-        finished_mutex = new std::mutex();
-        finished_cv = new std::condition_variable();
-
-        for (int i = 0; i < threads; i++)
-        {
-            starts.push_back(new std::atomic<int>(0));
-            ends.push_back(new std::atomic<int>(0));
-            waits.push_back(new std::atomic<bool>(0));
-            running.push_back(new std::atomic<bool>(1));
-            mutex.push_back(new std::mutex());
-            cv.push_back(new std::condition_variable());
-        }
-    }
-
-    ~SIMData()
-    {
-        delete finished_mutex;
-        delete finished_cv;
-
-        for (int i = 0; i < int(starts.size()); i++)
-        {
-            delete starts[i];
-            delete ends[i];
-            delete waits[i];
-            delete running[i];
-            delete mutex[i];
-            delete cv[i];
-        }
-    }
+    std::vector<Environment*> envs;
+    int simulations;
+    int leaf_batch;
 };
 
+/*
+Host class for the entire selfplay.
+Automatically manages model calls and batches to improve performance wherever possible.
+Is also managing multi threading since each environment is independent from ever other one this is very easy
+*/
+
 class Batcher
 {
 public:
@@ -174,12 +132,42 @@ public:
     bool getNextModelIndex(Environment* env);
 
 private:
-    // Run policy logic on one env
-    static void runPolicy(Environment* env);
+    // Run policy logic on one (root) tree of env, more than one leaf is spread using virtual loss
+    static void runPolicy(Environment* env, int leaves, int replica);
 
     // Clear up all network queues
     // You should never need to call it manually
     void runNetwork();
+    // Only the network queues of envs, cohorts running at the same time use their own buffers
+    void runNetwork(std::vector<Environment*>* envs, int cohort = 0);
+    // Stages of runNetwork, so searches can await them
+    // Resolves cache hits and duplicates of the queued nodes
+    void collectNetworkQueues(std::span<Environment*> envs, NetworkEvaluation& evaluation);
+    // Callback gets counted down by every submitted node, threaded conversion must not run inside of pool tasks
+    void submitNetworkQueues(NetworkEvaluation& evaluation, InferenceCallback* callback, bool threaded);
+    // Waits for the model outputs, then assigns them and clears the network queues per env
+    // Threaded spreads the envs over the pool, since their backpropagation is independent
+    void finishNetworkQueues(std::span<Environment*> envs, NetworkEvaluation& evaluation, bool threaded);
+
+    // Suspends a search until the network queue of its env is evaluated
+    class NetworkAwaiter
+    {
+    public:
+        // Allocations of the network stages get added to allocations (DEBUG_COUNT_ALLOCATIONS)
+        NetworkAwaiter(Batcher* batcher, Environment* env, NetworkEvaluation& evaluation, uint64_t& allocations);
+        bool await_ready();
+        // False if the outputs were already back before suspending
+        bool await_suspend(SearchTask::Handle handle);
+        void await_resume();
+
+    private:
+        Batcher* batcher;
+        Environment* env;
+        // Lives in the search, so its buffers are reused
+        NetworkEvaluation& evaluation;
+        uint64_t& allocations;
+        InferenceCallback callback;
+    };
 
     // Clears non_terminal_environments of terminals
     void updateNonTerminal();
@@ -192,23 +180,49 @@ private:
     std::vector<Environment*> non_terminal_environments;
     Model* models[2];
 
+    // Network outputs shared across environments, nullptr if disabled
+    EvaluationCache* eval_cache;
+    // One per model, nullptr if model is missing
+    InferenceServer* inference_servers[2];
+    // Per cohort, reused every round
+    NetworkEvaluation evaluations[2];
+    // Per coroutine search, reused by the searches of every move
+    std::vector<NetworkEvaluation> search_evaluations;
+    std::vector<Environment*> round_envs[2];
+
     // --------- Threading ---------
-    // Determine thread counts and start
+    // Determine thread count and start the pool
     void init_threads();
-    // Create the worker threads
-    void start_gcp(int threads);
-    void start_sim(int threads);
     // Threaded functions
-    void convertNodesToGamestates(torch::Tensor& target, std::vector<Node*>* nodes, torch::ScalarType dtype);
-    void runSimulationsOnEnvironments(std::vector<Environment*>* envs, int simulations);
-    // Helper
-    static void gcp_worker(GCPData* data, int id);
-    static void sim_worker(SIMData* data, int id);
-    // Helper Variables
-    std::vector<std::thread*> gcp;
-    std::vector<std::thread*> sim;
-    GCPData* gcp_data;
-    SIMData* sim_data;
+    // Writes the first rows of buffer, which is only reallocated if it is too small (pinned for accelerators)
+    void convertNodesToGamestates(torch::Tensor& buffer, std::vector<Node*>* nodes, torch::ScalarType dtype, bool pinned, bool threaded = true);
+    // Groups of both models share every round, so both models are busy at the same time
+    void runSimulationsOnEnvironments(std::vector<SimulationGroup>* groups);
+    // One policy round on envs, one pool task per root tree (per leaf in tree parallel search)
+    void runPolicies(std::vector<Environment*>* envs, int leaves);
+    // Policy round of every group with simulations left, their envs are collected in round_envs
+    void runPolicyRound(std::vector<SimulationGroup>* groups, int round, std::vector<Environment*>& round_envs);
+    // Sizes evaluation for the largest round groups can queue
+    void reserveEvaluation(NetworkEvaluation& evaluation, std::vector<SimulationGroup>* groups);
+    // Splits envs in two cohorts, one runs policy while the other ones leaves are in the model
+    void runPipelinedSimulations(std::vector<SimulationGroup>* groups);
+    // Network thread of the pipeline, runs the network of every cohort handed over with startNetwork
+    void networkLoop();
+    // Hands the network of cohort (in round_envs) to the network thread, starts it on first use
+    void startNetwork(int cohort);
+    // Blocks until the network of the last started cohort is done
+    void waitNetwork();
+    // Every env searches as its own coroutine, pool threads resume whichever searches have their leaves evaluated
+    void runCoroutineSimulations(std::vector<SimulationGroup>* groups);
+    SearchTask searchEnvironment(Environment* env, NetworkEvaluation& evaluation, int simulations, int leaf_batch);
+    // Shared by gamestate conversion and simulations
+    ThreadPool* pool;
+    // Lives as long as the batcher once pipelining started
+    std::thread network_thread;
+    // Cohort the network thread runs, IdleCohort once done, StopCohort ends the thread
+    std::atomic<int> network_cohort;
+    static constexpr int IdleCohort = -1;
+    static constexpr int StopCohort = -2;
 
     void outputTree(Node* root, int envid);
 
@@ -11,6 +11,10 @@ std::string Config::datapoint_path = DatapointPath;
 int Config::history_depth = HistoryDepth;
 int Config::max_datapoints = MaxDatapoints;
 int Config::default_simulations = DefaultSimulations;
+int Config::default_leaf_batch = DefaultLeafBatch;
+int Config::root_trees = RootTrees;
+float Config::root_tree_noise = RootTreeNoise;
+float Config::root_tree_noise_alpha = RootTreeNoiseAlpha;
 float Config::exploration_bias = ExplorationBias;
 float Config::policy_bias = PolicyBias;
 float Config::value_bias = ValueBias;
@@ -32,6 +36,17 @@ bool Config::output_trees = false;
 std::string Config::output_trees_path = TreesPath;
 bool Config::nocache = false;
 int Config::rng_seed = -1;
+int Config::eval_cache_size = EvalCacheSize;
+bool Config::graph_search = false;
+bool Config::huge_pages = false;
+torch::ScalarType Config::prior_scalar = PriorDefaultScalar;
+bool Config::stateless_nodes = false;
+bool Config::pipeline_cohorts = false;
+bool Config::coroutine_search = false;
+bool Config::tree_parallel = false;
+int Config::inference_deadline = InferenceDeadline;
+bool Config::compact_input = false;
+bool Config::fuse_models = false;
 
 std::string Config::version()
 {
@@ -63,6 +78,26 @@ int Config::defaultSimulations()
     return default_simulations;
 }
 
+int Config::defaultLeafBatch()
+{
+    return default_leaf_batch;
+}
+
+int Config::rootTrees()
+{
+    return root_trees;
+}
+
+float Config::rootTreeNoise()
+{
+    return root_tree_noise;
+}
+
+float Config::rootTreeNoiseAlpha()
+{
+    return root_tree_noise_alpha;
+}
+
 int Config::environmentCount()
 {
     return environment_count;
@@ -163,6 +198,61 @@ int Config::seed()
     return rng_seed;
 }
 
+int Config::evalCacheSize()
+{
+    return eval_cache_size;
+}
+
+bool Config::graphSearch()
+{
+    return graph_search;
+}
+
+bool Config::hugePages()
+{
+    return huge_pages;
+}
+
+torch::ScalarType Config::priorScalar()
+{
+    return prior_scalar;
+}
+
+bool Config::statelessNodes()
+{
+    return stateless_nodes;
+}
+
+bool Config::pipeline()
+{
+    return pipeline_cohorts;
+}
+
+bool Config::coroutineSearch()
+{
+    return coroutine_search;
+}
+
+bool Config::treeParallel()
+{
+    return tree_parallel;
+}
+
+int Config::inferenceDeadline()
+{
+    return inference_deadline;
+}
+
+bool Config::compactInput()
+{
+    return compact_input;
+}
+
+bool Config::fuseModels()
+{
+    return fuse_models;
+}
+
 void Config::setModelPath(std::string path)
 {
     model_path = path;
@@ -188,6 +278,27 @@ void Config::setDefaultSimulations(int sims)
     default_simulations = sims;
 }
 
+void Config::setDefaultLeafBatch(int leaves)
+{
+    default_leaf_batch = std::max(1, leaves);
+}
+
+void Config::setRootTrees(int trees)
+{
+    root_trees = std::max(1, trees);
+}
+
+void Config::setRootTreeNoise(float noise)
+{
+    root_tree_noise = std::clamp(noise, 0.0f, 1.0f);
+}
+
+void Config::setRootTreeNoiseAlpha(float alpha)
+{
+    // Gamma distribution needs a positive shape
+    root_tree_noise_alpha = std::max(0.001f, alpha);
+}
+
 void Config::setEnvironmentCount(int envs)
 {
     environment_count = envs;
@@ -291,4 +402,59 @@ void Config::setNoCache(bool cache)
 void Config::setSeed(int seed)
 {
     rng_seed = seed;
+}
+
+void Config::setEvalCacheSize(int size)
+{
+    eval_cache_size = size;
+}
+
+void Config::setGraphSearch(bool graph)
+{
+    graph_search = graph;
+}
+
+void Config::setHugePages(bool huge)
+{
+    huge_pages = huge;
+}
+
+void Config::setPriorScalar(torch::ScalarType scalar)
+{
+    prior_scalar = scalar;
+}
+
+void Config::setStatelessNodes(bool stateless)
+{
+    stateless_nodes = stateless;
+}
+
+void Config::setPipeline(bool pipeline)
+{
+    pipeline_cohorts = pipeline;
+}
+
+void Config::setCoroutineSearch(bool coroutines)
+{
+    coroutine_search = coroutines;
+}
+
+void Config::setTreeParallel(bool parallel)
+{
+    tree_parallel = parallel;
+}
+
+void Config::setInferenceDeadline(int microseconds)
+{
+    inference_deadline = std::max(0, microseconds);
+}
+
+void Config::setCompactInput(bool compact)
+{
+    compact_input = compact;
+}
+
+void Config::setFuseModels(bool fuse)
+{
+    fuse_models = fuse;
 }
\ No newline at end of file
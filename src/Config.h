@@ -8,6 +8,16 @@
 #include "torch/torch.h"
 #include <iostream>
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <bitset>
+#include <optional>
+#include <future>
+#include <coroutine>
+#include <span>
 #include <list>
 #include <random>
 #include <algorithm>
@@ -24,8 +34,13 @@
 #include <mutex>
 #include <chrono>
 #include <condition_variable>
+#include <bit>
 
 //#define DEBUG_INVERT_MODEL_COLORS
+// Count heap allocations of simulation rounds (AllocationCounter)
+//#define DEBUG_COUNT_ALLOCATIONS
+// Compare history planes derived from the parent with the planes walked from the move history
+//#define DEBUG_CHECK_HISTORY_PLANES
 
 /* -#-#-# Deep Settings, will trigger recompile #-#-#- */
 
@@ -51,7 +66,14 @@
 
 // MCTS Master parameters
 #define DefaultSimulations 1600
+// Leaves collected per tree and network call, spread by virtual loss
+#define DefaultLeafBatch 1
 #define DefaultEnvironments 10
+// Independent trees per environment, root visits are merged at move time
+#define RootTrees 1
+// Dirichlet noise mixed into the root priors of every additional root tree, so they search differently
+#define RootTreeNoise 0.25f
+#define RootTreeNoiseAlpha 0.3f
 
 // Algorithm Hyperparameters
 #define ExplorationBias 1
@@ -60,13 +82,13 @@
 
 
 // ---- Performance Settings ----
-// This is max threads PER task, so could be MaxThreads * 2 effective threads
+// Threads of the shared work stealing pool, including the thread submitting work
 // To disable threading just set to 1 --> will use main thread
 #define MaxThreads 4
-// These are target values, will not always be matched
-// How many simulations a thread should aim to handle
-#define PerThreadSimulations 64
-// How many nodes a single thread should convert to gamestates
+// Task sizes, small tasks balance better, large tasks have less overhead
+// How many environments a simulation task handles
+#define PerThreadSimulations 1
+// How many nodes a gamestate conversion task handles
 #define PerThreadGamestateConvertions 32
 
 // Torch Settings
@@ -76,8 +98,16 @@
 #define TorchInferenceDevice torch::kCPU
 // Floating point precision for Inference
 #define TorchDefaultScalar torch::kFloat32
+// Storage of priors in tree nodes (kFloat32, kFloat16 or kUInt8 quantized)
+#define PriorDefaultScalar torch::kFloat32
 // Higher is better if VRAM/RAM can handle
 #define MaxBatchsize 2048
+// Microseconds a partial batch waits for more requests before inference starts, 0 runs it right away
+#define InferenceDeadline 0
+// Network outputs kept for reuse across environments, 0 disables (opt-in with --evalcache)
+#define EvalCacheSize 0
+// Size of memory chunks each trees arena requests at once (2MiB is one huge page)
+#define ArenaChunkSize (2 << 20)
 // -------------------------------
 
 // Save memory if 2d -> 1d index mapping fits in 2^8
@@ -96,6 +126,10 @@ private:
     static int history_depth;
     static int max_datapoints;
     static int default_simulations;
+    static int default_leaf_batch;
+    static int root_trees;
+    static float root_tree_noise;
+    static float root_tree_noise_alpha;
     static float exploration_bias;
     static float policy_bias;
     static float value_bias;
@@ -116,6 +150,17 @@ private:
     static std::string output_trees_path;
     static bool nocache;
     static int rng_seed;
+    static int eval_cache_size;
+    static bool graph_search;
+    static bool huge_pages;
+    static torch::ScalarType prior_scalar;
+    static bool stateless_nodes;
+    static bool pipeline_cohorts;
+    static bool coroutine_search;
+    static bool tree_parallel;
+    static int inference_deadline;
+    static bool compact_input;
+    static bool fuse_models;
 
 public:
     static std::string modelPath();
@@ -123,6 +168,10 @@ public:
     static int historyDepth();
     static int maxDatapoints();
     static int defaultSimulations();
+    static int defaultLeafBatch();
+    static int rootTrees();
+    static float rootTreeNoise();
+    static float rootTreeNoiseAlpha();
     static float explorationBias();
     static float policyBias();
     static float valueBias();
@@ -144,12 +193,27 @@ public:
     static std::string outputTreesPath();
     static bool noCache();
     static int seed();
+    static int evalCacheSize();
+    static bool graphSearch();
+    static bool hugePages();
+    static torch::ScalarType priorScalar();
+    static bool statelessNodes();
+    static bool pipeline();
+    static bool coroutineSearch();
+    static bool treeParallel();
+    static int inferenceDeadline();
+    static bool compactInput();
+    static bool fuseModels();
 
     static void setModelPath(std::string path);
     static void setDatapointPath(std::string path);
     static void setHistoryDepth(int depth);
     static void setMaxDatapoints(int datapoints);
     static void setDefaultSimulations(int sims);
+    static void setDefaultLeafBatch(int leaves);
+    static void setRootTrees(int trees);
+    static void setRootTreeNoise(float noise);
+    static void setRootTreeNoiseAlpha(float alpha);
     static void setExplorationBias(float bias);
     static void setPolicyBias(float bias);
     static void setValueBias(float bias);
@@ -171,6 +235,17 @@ public:
     static void setOutputTreesPath(std::string path);
     static void setNoCache(bool nocache);
     static void setSeed(int seed);
+    static void setEvalCacheSize(int size);
+    static void setGraphSearch(bool graph);
+    static void setHugePages(bool huge);
+    static void setPriorScalar(torch::ScalarType scalar);
+    static void setStatelessNodes(bool stateless);
+    static void setPipeline(bool pipeline);
+    static void setCoroutineSearch(bool coroutines);
+    static void setTreeParallel(bool parallel);
+    static void setInferenceDeadline(int microseconds);
+    static void setCompactInput(bool compact);
+    static void setFuseModels(bool fuse);
 
     // Prevent instantiation
     Config() = delete;
@@ -10,7 +10,6 @@
 #include "Log.h"
 #include "TreeVisualizer.h"
 
-// TODO: Move state to TempData and change node to gamestate to create only from parent pointers
 // BATCHER stuck on deconstruction?!
 
 std::vector<std::string> valid_args = {
@@ -22,6 +21,12 @@ std::vector<std::string> valid_args = {
     "simulations",
     "simulations1",
     "simulations2",
+    "leafbatch",
+    "leafbatch1",
+    "leafbatch2",
+    "roottrees",
+    "rootnoise",
+    "rootnoisealpha",
     "device",
     "device1",
     "device2",
@@ -41,6 +46,7 @@ std::vector<std::string> valid_args = {
     "modelpath",
     "threads",
     "batchsize",
+    "deadline",
     "policybias",
     "valuebias",
     "explorationbias",
@@ -49,6 +55,16 @@ std::vector<std::string> valid_args = {
     "outputtrees",
     "outputtreespath",
     "seed",
+    "evalcache",
+    "graphsearch",
+    "hugepages",
+    "priors",
+    "stateless",
+    "pipeline",
+    "coroutines",
+    "treeparallel",
+    "compactinput",
+    "fusemodels",
     "version"
 };
 
@@ -66,6 +82,12 @@ std::map<std::string, torch::ScalarType> scalar_map = {
     {"full", torch::kFloat32}
 };
 
+std::map<std::string, torch::ScalarType> prior_map = {
+    {"float32", torch::kFloat32},
+    {"float16", torch::kFloat16},
+    {"uint8", torch::kUInt8}
+};
+
 void printInfo()
 {
     std::cout << "#### AlphaGomoku v." << Config::version() << " © Alexander Kurtz 2023 ####" << std::endl;
@@ -126,6 +148,14 @@ void applyConfigArgs(std::map<std::string, std::string>& args)
     {
         if (args.find("simulations") != args.end())
             Config::setDefaultSimulations(std::stoi(args["simulations"]));
+        if (args.find("leafbatch") != args.end())
+            Config::setDefaultLeafBatch(std::stoi(args["leafbatch"]));
+        if (args.find("roottrees") != args.end())
+            Config::setRootTrees(std::stoi(args["roottrees"]));
+        if (args.find("rootnoise") != args.end())
+            Config::setRootTreeNoise(std::stof(args["rootnoise"]));
+        if (args.find("rootnoisealpha") != args.end())
+            Config::setRootTreeNoiseAlpha(std::stof(args["rootnoisealpha"]));
         if (args.find("device") != args.end())
         {
             auto it = device_map.find(args["device"]);
@@ -182,6 +212,105 @@ void applyConfigArgs(std::map<std::string, std::string>& args)
             else
                 Log::log(LogLevel::WARNING, "Invalid argument: seed needs to be a positive integer");
         }
+        if (args.find("graphsearch") != args.end())
+        {
+            if (args["graphsearch"] == "true" || args["graphsearch"] == "1")
+                Config::setGraphSearch(true);
+            else if (args["graphsearch"] == "false" || args["graphsearch"] == "0")
+                Config::setGraphSearch(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: graphsearch needs to be a boolean");
+        }
+        if (args.find("hugepages") != args.end())
+        {
+            if (args["hugepages"] == "true" || args["hugepages"] == "1")
+                Config::setHugePages(true);
+            else if (args["hugepages"] == "false" || args["hugepages"] == "0")
+                Config::setHugePages(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: hugepages needs to be a boolean");
+        }
+        if (args.find("stateless") != args.end())
+        {
+            if (args["stateless"] == "true" || args["stateless"] == "1")
+                Config::setStatelessNodes(true);
+            else if (args["stateless"] == "false" || args["stateless"] == "0")
+                Config::setStatelessNodes(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: stateless needs to be a boolean");
+        }
+        if (args.find("pipeline") != args.end())
+        {
+            if (args["pipeline"] == "true" || args["pipeline"] == "1")
+                Config::setPipeline(true);
+            else if (args["pipeline"] == "false" || args["pipeline"] == "0")
+                Config::setPipeline(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: pipeline needs to be a boolean");
+        }
+        if (args.find("coroutines") != args.end())
+        {
+            if (args["coroutines"] == "true" || args["coroutines"] == "1")
+                Config::setCoroutineSearch(true);
+            else if (args["coroutines"] == "false" || args["coroutines"] == "0")
+                Config::setCoroutineSearch(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: coroutines needs to be a boolean");
+        }
+        if (args.find("treeparallel") != args.end())
+        {
+            if (args["treeparallel"] == "true" || args["treeparallel"] == "1")
+                Config::setTreeParallel(true);
+            else if (args["treeparallel"] == "false" || args["treeparallel"] == "0")
+                Config::setTreeParallel(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: treeparallel needs to be a boolean");
+        }
+        if (args.find("compactinput") != args.end())
+        {
+            if (args["compactinput"] == "true" || args["compactinput"] == "1")
+                Config::setCompactInput(true);
+            else if (args["compactinput"] == "false" || args["compactinput"] == "0")
+                Config::setCompactInput(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: compactinput needs to be a boolean");
+        }
+        if (args.find("fusemodels") != args.end())
+        {
+            if (args["fusemodels"] == "true" || args["fusemodels"] == "1")
+                Config::setFuseModels(true);
+            else if (args["fusemodels"] == "false" || args["fusemodels"] == "0")
+                Config::setFuseModels(false);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: fusemodels needs to be a boolean");
+        }
+        // Transpositions are found by the hash of each nodes state
+        if (Config::statelessNodes() && Config::graphSearch())
+        {
+            Log::log(LogLevel::WARNING, "Stateless nodes are not supported with graph search, disabling stateless nodes");
+            Config::setStatelessNodes(false);
+        }
+        // The transposition table is shared by every path through the tree
+        if (Config::treeParallel() && Config::graphSearch())
+        {
+            Log::log(LogLevel::WARNING, "Tree parallel search is not supported with graph search, disabling tree parallel search");
+            Config::setTreeParallel(false);
+        }
+        if (args.find("priors") != args.end())
+        {
+            if (prior_map.find(args["priors"]) != prior_map.end())
+                Config::setPriorScalar(prior_map[args["priors"]]);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: priors needs to be float32, float16 or uint8");
+        }
+        if (args.find("evalcache") != args.end())
+        {
+            int size = std::stoi(args["evalcache"]);
+            if (size >= 0)
+                Config::setEvalCacheSize(size);
+            else
+                Log::log(LogLevel::WARNING, "Invalid argument: evalcache needs to be a positive integer");
+        }
         if (args.find("outputtreespath") != args.end())
             Config::setOutputTreesPath(args["outputtreespath"]);
         if (args.find("environments") != args.end())
@@ -204,6 +333,8 @@ void applyConfigArgs(std::map<std::string, std::string>& args)
             Config::setMaxThreads(std::stoi(args["threads"]));
         if (args.find("batchsize") != args.end())
             Config::setMaxBatchsize(std::stoi(args["batchsize"]));
+        if (args.find("deadline") != args.end())
+            Config::setInferenceDeadline(std::stoi(args["deadline"]));
         if (args.find("renderenvs") != args.end())
         {
             if (args["renderenvs"] == "true")
@@ -289,6 +420,8 @@ std::tuple<Model*, Model*> configModels(std::map<std::string, std::string>& args
         {
             if (args.find("simulations1") != args.end())
                 model_1->setSimulations(std::stoi(args["simulations1"]));
+            if (args.find("leafbatch1") != args.end())
+                model_1->setLeafBatch(std::stoi(args["leafbatch1"]));
             if (args.find("device1") != args.end())
             {
                 auto it = device_map.find(args["device1"]);
@@ -321,6 +454,8 @@ std::tuple<Model*, Model*> configModels(std::map<std::string, std::string>& args
         {
             if (args.find("simulations2") != args.end())
                 model_2->setSimulations(std::stoi(args["simulations2"]));
+            if (args.find("leafbatch2") != args.end())
+                model_2->setLeafBatch(std::stoi(args["leafbatch2"]));
             if (args.find("device2") != args.end())
             {
                 auto it = device_map.find(args["device2"]);
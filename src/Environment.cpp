@@ -5,22 +5,44 @@
 
 #include "Environment.h"
 
-Environment::Environment(bool dual_tree)
+Environment::Environment(bool dual_tree, uint32_t seed)
     : next_color(false), swapped_models(false)
 { 
     trees[1] = nullptr;
+    std::mt19937 seeds(seed);
 
     // We only init one tree if not in dual tree mode
     for (int i = 0; i < dual_tree + 1; i++)
+    {
         trees[i] = new Tree();
+
+        for (int replica = 1; replica < Config::rootTrees(); replica++)
+        {
+            // Kept positive, -1 would leave the tree without noise
+            replicas[i].push_back(new Tree(int(seeds() >> 1)));
+        }
+    }
 }
 
 Environment::~Environment()
 {
     // Delete trees
     for (int i = 0; i < 2; i ++)
+    {
         if (trees[i] != nullptr)
             delete trees[i];
+        for (Tree* replica : replicas[i])
+            delete replica;
+    }
+}
+
+Tree* Environment::getTree(int replica)
+{
+    // If only 1 tree always use 1.
+    int index = next_color * (trees[1] != nullptr);
+    if (replica == 0)
+        return trees[index];
+    return replicas[index][replica - 1];
 }
 
 bool Environment::makeMove(index_t index)
@@ -35,9 +57,14 @@ bool Environment::makeMove(uint8_t x, uint8_t y)
     bool success = true;
     // Update all existing trees
     for (int i = 0; i < 2; i ++)
+    {
         if (trees[i] != nullptr)
             if (!trees[i]->makeMove(x, y))
                 success = false;
+        for (Tree* replica : replicas[i])
+            if (!replica->makeMove(x, y))
+                success = false;
+    }
 
     if (success)
         next_color = !next_color;
@@ -66,9 +93,28 @@ bool Environment::areModelsSwapped()
 
 bool Environment::makeBestMove()
 {
-    Node* node = getCurrentNode()->absBestChild();
-    if (node)
-        return makeMove(node->getParentAction());
+    if (Config::rootTrees() > 1)
+    {
+        // Sum root visits of all replicas per move
+        std::array<uint32_t, BoardSize * BoardSize> visits{};
+        for (int replica = 0; replica < Config::rootTrees(); replica++)
+        {
+            Node* root = getTree(replica)->getCurrentNode();
+            for (size_t i = 0; i < root->children.size(); i++)
+                visits[root->child_actions[i]] += root->children[i]->getVisits();
+        }
+
+        auto best = std::max_element(visits.begin(), visits.end());
+        if (*best > 0)
+            return makeMove(index_t(best - visits.begin()));
+    }
+    else
+    {
+        Node* current = getCurrentNode();
+        Node* node = current->absBestChild();
+        if (node)
+            return makeMove(current->getActionTo(node));
+    }
 
     Log::log(LogLevel::WARNING, "Get absBestChild failed in makeBestMove", "ENVIRONMENT");
     return false;
@@ -80,16 +126,13 @@ std::vector<index_t> Environment::getUntriedActions()
     return getCurrentNode()->getUntriedActions();
 }
 
-Node* Environment::policy()
+Node* Environment::policy(bool virtual_loss, int replica)
 {
-    // If only 1 tree always call policy on 1.
-    return trees[next_color * (trees[1] != nullptr)]->policy();
+    return getTree(replica)->policy(virtual_loss);
 }
 
-std::vector<std::tuple<Node*, bool>> Environment::getNetworkQueue()
+void Environment::getNetworkQueue(std::vector<std::tuple<Node*, bool>>& queue)
 {
-    std::vector<std::tuple<Node*, bool>> queue;
-
     // Get vector of queue with network ID
     for (int i = 0; i < 2; i++)
     {
@@ -101,26 +144,38 @@ std::vector<std::tuple<Node*, bool>> Environment::getNetworkQueue()
                 else
                     queue.push_back(std::tuple<Node*, bool>(node, i));
         }
-    }
 
-    return queue;
+        // Replicas run on the same model as their main tree
+        for (Tree* replica : replicas[i])
+            for (Node* node : replica->getNetworkQueue())
+                queue.push_back(std::tuple<Node*, bool>(node, swapped_models ? !i : i));
+    }
 }
 
 bool Environment::clearNetworkQueue()
 {
     bool success = true;
     for (int i = 0; i < 2; i++)
+    {
         if (trees[i] != nullptr)
             if (!trees[i]->clearNetworkQueue())
                 success = false;
+        for (Tree* replica : replicas[i])
+            if (!replica->clearNetworkQueue())
+                success = false;
+    }
     return success;
 }
 
 void Environment::forceClearNetworkQueue()
 {
     for (int i = 0; i < 2; i++)
+    {
         if (trees[i] != nullptr)
             trees[i]->forceClearNetworkQueue();
+        for (Tree* replica : replicas[i])
+            replica->forceClearNetworkQueue();
+    }
 }
 
 Node* Environment::getCurrentNode()
@@ -131,8 +186,12 @@ Node* Environment::getCurrentNode()
 void Environment::collapseEnvironment()
 {
     for (int i = 0; i < 2; i++)
+    {
         if (trees[i] != nullptr)
             trees[i]->collapseTree();
+        for (Tree* replica : replicas[i])
+            replica->collapseTree();
+    }
 }
 
 Node* Environment::getOpposingNode()
@@ -145,8 +204,12 @@ Node* Environment::getOpposingNode()
 void Environment::freeMemory()
 {
     for (int i = 0; i < 2; i ++)
+    {
         if (trees[i] != nullptr)
-            trees[i]->clean(); 
+            trees[i]->clean();
+        for (Tree* replica : replicas[i])
+            replica->clean();
+    }
 }
 
 std::string Environment::toString()
@@ -16,26 +16,32 @@ Environment stores 2 Trees and syncs them so that each Model / Agent has his own
 (Relevant for not needing to store different values for "same" node for 2 different models in each Tree)
 
 Also has a queue for deleting obsolete nodes, this might not be neccessary.
+
+With Config::rootTrees > 1 every tree gets independent replicas with their own seed (root parallel search).
+Each replica is searched on its own, their root child visits are summed in makeBestMove.
 */
 
 class Environment
 {
 public:
-    Environment(bool dual_tree);
+    // Seed of the replica trees, each replica draws its own from it
+    Environment(bool dual_tree, uint32_t seed);
     ~Environment();
 
     // These functions can/will require a NN computation, those will be stored in trees netqueues
     bool makeMove(uint8_t x, uint8_t y);
     bool makeMove(index_t index);
     bool makeBestMove();
-    Node* policy();
+    // Replica 0 is the main tree
+    Node* policy(bool virtual_loss = false, int replica = 0);
     // <-------------------->
 
     std::vector<Node*> getRootNodes();
 
     // These are wrappers around tree, it just translates it to the env
     // This network queue has a tuple to with network it needs to be run on
-    std::vector<std::tuple<Node*, bool>> getNetworkQueue();
+    // Appends to queue, so callers can reuse one buffer
+    void getNetworkQueue(std::vector<std::tuple<Node*, bool>>& queue);
     bool clearNetworkQueue();
     void forceClearNetworkQueue();
     // Black is 0, White is 1, Draw is 2
@@ -66,7 +72,12 @@ public:
     void freeMemory();
 
 private:
+    // Tree of the next player, replica 0 is the main tree
+    Tree* getTree(int replica);
+
     Tree* trees[2];
+    // Additional root trees of each tree, kept in sync by makeMove
+    std::vector<Tree*> replicas[2];
     bool next_color;
     bool swapped_models;
 };
\ No newline at end of file
@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "EvaluationCache.h"
+
+EvaluationCache::EvaluationCache(int capacity)
+    : shard_capacity(std::max(1, capacity / shard_count)), hits(0), misses(0)
+{
+    // At most half full, so probes stay short
+    size_t table_size = 1;
+    while (table_size < shard_capacity * 2)
+        table_size *= 2;
+
+    for (int i = 0; i < shard_count; i++)
+    {
+        shards[i] = new EvaluationCacheShard();
+        shards[i]->entries.reserve(shard_capacity);
+        shards[i]->next = 0;
+        shards[i]->table.assign(table_size, -1);
+    }
+
+    Log::log(LogLevel::INFO, "Created evaluation cache with " + std::to_string(shard_capacity * shard_count) + " entries", "CACHE");
+}
+
+EvaluationCache::~EvaluationCache()
+{
+    Log::log(LogLevel::INFO, "Evaluation cache hits: " + std::to_string(getHits()) + " misses: " + std::to_string(getMisses()), "CACHE");
+
+    for (int i = 0; i < shard_count; i++)
+        delete shards[i];
+}
+
+uint64_t EvaluationCache::key(Model* model, uint64_t hash)
+{
+    // Spread the pointer bits so two models never share keys for the same position
+    uint64_t model_key = reinterpret_cast<uintptr_t>(model) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (model_key ^ (model_key >> 32));
+}
+
+EvaluationCacheShard* EvaluationCache::getShard(uint64_t key)
+{
+    return shards[(key >> 60) % shard_count];
+}
+
+size_t EvaluationCacheShard::find(uint64_t key)
+{
+    size_t mask = table.size() - 1;
+    size_t slot = key & mask;
+    while (table[slot] != -1 && entries[table[slot]].key != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+void EvaluationCacheShard::remove(uint64_t key)
+{
+    size_t mask = table.size() - 1;
+    size_t slot = find(key);
+    if (table[slot] == -1)
+        return;
+    table[slot] = -1;
+
+    // Shift following entries back into the gap, unless they would move before their home slot
+    for (size_t next = (slot + 1) & mask; table[next] != -1; next = (next + 1) & mask)
+    {
+        size_t home = entries[table[next]].key & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            table[slot] = table[next];
+            table[next] = -1;
+            slot = next;
+        }
+    }
+}
+
+bool EvaluationCache::lookup(Model* model, uint64_t hash, EvaluationCacheEntry& entry)
+{
+    uint64_t cache_key = key(model, hash);
+    EvaluationCacheShard* shard = getShard(cache_key);
+
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    int index = shard->table[shard->find(cache_key)];
+    if (index == -1)
+    {
+        misses++;
+        return false;
+    }
+
+    entry = shard->entries[index];
+    hits++;
+    return true;
+}
+
+void EvaluationCache::insert(Model* model, uint64_t hash, const float* policy, float value)
+{
+    uint64_t cache_key = key(model, hash);
+    EvaluationCacheShard* shard = getShard(cache_key);
+
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    size_t slot = shard->find(cache_key);
+    if (shard->table[slot] != -1)
+        return;
+
+    // Evict oldest, its entry is overwritten
+    size_t index = shard->next;
+    if (shard->entries.size() < shard_capacity)
+        shard->entries.emplace_back();
+    else
+    {
+        shard->remove(shard->entries[index].key);
+        slot = shard->find(cache_key);
+    }
+    shard->next = (index + 1) % shard_capacity;
+
+    EvaluationCacheEntry& entry = shard->entries[index];
+    entry.key = cache_key;
+    entry.value = value;
+    std::copy(policy, policy + BoardSize * BoardSize, entry.policy.begin());
+    shard->table[slot] = int(index);
+}
+
+uint64_t EvaluationCache::getHits()
+{
+    return hits.load();
+}
+
+uint64_t EvaluationCache::getMisses()
+{
+    return misses.load();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "Config.h"
+#include "Model.h"
+#include "Log.h"
+
+/*
+Bounded cache of network outputs shared between all environments of a batcher.
+Entries are keyed by the model and the history aware position hash (Node::getHistoryHash),
+so a position is only ever run through a model once while it stays cached.
+
+The cache is split into shards with their own mutex, oldest entries of a shard get evicted first.
+Entries are plain floats in memory reserved up front, so inserting and evicting never allocates.
+*/
+
+struct EvaluationCacheEntry
+{
+    uint64_t key;
+    float value;
+    std::array<float, BoardSize * BoardSize> policy;
+};
+
+struct EvaluationCacheShard
+{
+    std::mutex mutex;
+    // Ring in insertion order, once full the next insert overwrites the oldest entry
+    std::vector<EvaluationCacheEntry> entries;
+    size_t next;
+    // Open addressing index from key to entry, -1 is empty
+    std::vector<int> table;
+
+    // Slot of key in table, or the empty slot it would go into
+    size_t find(uint64_t key);
+    void remove(uint64_t key);
+};
+
+class EvaluationCache
+{
+public:
+    EvaluationCache(int capacity);
+    ~EvaluationCache();
+
+    // Returns if entry was found, copies it into entry
+    bool lookup(Model* model, uint64_t hash, EvaluationCacheEntry& entry);
+    // Policy holds BoardSize * BoardSize priors
+    void insert(Model* model, uint64_t hash, const float* policy, float value);
+
+    uint64_t getHits();
+    uint64_t getMisses();
+
+private:
+    static constexpr int shard_count = 16;
+
+    // Combines model identity and position hash
+    static uint64_t key(Model* model, uint64_t hash);
+    EvaluationCacheShard* getShard(uint64_t key);
+
+    EvaluationCacheShard* shards[shard_count];
+    size_t shard_capacity;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+};
@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "InferenceServer.h"
+
+InferenceServer::InferenceServer(Model* model)
+    : model(model), head(nullptr), free_requests(nullptr), queued_rows(0), running(true)
+{
+    thread = std::thread(&InferenceServer::serve, this);
+    Log::log(LogLevel::INFO, "Started inference server for " + model->getName(), "INFERENCE");
+}
+
+InferenceServer::~InferenceServer()
+{
+    running.store(false);
+    notifyServer();
+    thread.join();
+
+    for (InferenceRequest* request = free_requests.load(); request;)
+    {
+        InferenceRequest* next = request->next;
+        delete request;
+        request = next;
+    }
+}
+
+Model* InferenceServer::getModel()
+{
+    return model;
+}
+
+void InferenceServer::submit(torch::Tensor gamestates, int count, std::vector<InferenceResult>& results, InferenceCallback* callback)
+{
+    if (count == 0)
+        return;
+
+    int max_batchsize = Config::maxBatchsize();
+    if (callback)
+        callback->remaining.fetch_add((count + max_batchsize - 1) / max_batchsize);
+
+    // Counted before the requests are visible, so the server never takes rows it does not know of
+    int queued = queued_rows.fetch_add(count) + count;
+
+    // Chain all requests first so they reach the server together, newest first like the stack
+    auto now = std::chrono::steady_clock::now();
+    InferenceRequest* pooled = free_requests.exchange(nullptr, std::memory_order_acquire);
+    InferenceRequest* first = nullptr;
+    InferenceRequest* last = nullptr;
+    for (int offset = 0; offset < count; offset += max_batchsize)
+    {
+        InferenceRequest* request = pooled;
+        if (request)
+            pooled = pooled->next;
+        else
+            request = new InferenceRequest();
+
+        // Offsets instead of a view, so a request does not allocate a tensor
+        request->input = gamestates;
+        request->input_offset = offset;
+        request->rows = std::min(max_batchsize, count - offset);
+        request->done.store(false, std::memory_order_relaxed);
+        request->submitted = now;
+        request->callback = callback;
+        request->next = last;
+        results.emplace_back(this, request);
+
+        if (first == nullptr)
+            first = request;
+        last = request;
+    }
+
+    // Unused requests go back to the pool
+    while (pooled)
+    {
+        InferenceRequest* next = pooled->next;
+        recycle(pooled);
+        pooled = next;
+    }
+
+    InferenceRequest* old_head = head.load(std::memory_order_relaxed);
+    do
+        first->next = old_head;
+    while (!head.compare_exchange_weak(old_head, last, std::memory_order_release, std::memory_order_relaxed));
+
+    // An idle server sleeps until something is queued, a waiting one until the deadline or a full batch
+    if (queued == count || queued >= max_batchsize)
+        notifyServer();
+}
+
+void InferenceServer::notifyServer()
+{
+    // Taking the lock orders the notify after the server checked its condition and went to sleep
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex);
+    }
+    wakeup.notify_one();
+}
+
+void InferenceServer::serve()
+{
+    // Oldest request first, a vector keeps its memory where a deque would allocate blocks as it moves
+    std::vector<InferenceRequest*> waiting;
+    std::vector<InferenceRequest*> incoming;
+    std::vector<InferenceRequest*> batch;
+    int waiting_rows = 0;
+    int batches = 0;
+
+    // A batch holds at most one request per row
+    batch.reserve(Config::maxBatchsize());
+
+    // Whole requests in submission order, at least one even if it is larger than a batch
+    auto run_batch = [&](int max_batchsize) {
+        batch.clear();
+        int rows = 0;
+        while (batch.size() < waiting.size() && (batch.empty() || rows + waiting[batch.size()]->rows <= max_batchsize))
+        {
+            rows += waiting[batch.size()]->rows;
+            batch.push_back(waiting[batch.size()]);
+        }
+        waiting.erase(waiting.begin(), waiting.begin() + batch.size());
+        waiting_rows -= rows;
+        queued_rows.fetch_sub(rows);
+
+        uint64_t allocations = AllocationCounter::threadCount();
+        runBatch(batch, rows);
+        AllocationCounter::checkRound("INFERENCE", batches++, AllocationCounter::threadCount() - allocations);
+    };
+
+    while (true)
+    {
+        // Take everything submitted so far and restore submission order
+        incoming.clear();
+        for (InferenceRequest* request = head.exchange(nullptr, std::memory_order_acquire); request; request = request->next)
+            incoming.push_back(request);
+        for (auto request = incoming.rbegin(); request != incoming.rend(); request++)
+        {
+            waiting.push_back(*request);
+            waiting_rows += (*request)->rows;
+        }
+
+        if (waiting.empty())
+        {
+            if (!running.load())
+                return;
+            std::unique_lock<std::mutex> lock(wakeup_mutex);
+            wakeup.wait(lock, [this]() { return queued_rows.load() > 0 || !running.load(); });
+            continue;
+        }
+
+        // Full batches go right away
+        int max_batchsize = Config::maxBatchsize();
+        while (waiting_rows >= max_batchsize)
+            run_batch(max_batchsize);
+
+        if (waiting.empty())
+            continue;
+
+        // Partial batch waits for more requests until the oldest one hits the deadline, submitting wakes it once a batch is full
+        auto deadline = waiting.front()->submitted + std::chrono::microseconds(Config::inferenceDeadline());
+        if (std::chrono::steady_clock::now() < deadline && running.load())
+        {
+            std::unique_lock<std::mutex> lock(wakeup_mutex);
+            wakeup.wait_until(lock, deadline, [this, max_batchsize]() { return queued_rows.load() >= max_batchsize || !running.load(); });
+            continue;
+        }
+
+        while (!waiting.empty())
+            run_batch(max_batchsize);
+    }
+}
+
+void InferenceServer::runBatch(std::vector<InferenceRequest*>& batch, int rows)
+{
+    // Disable gradients for this scope
+    torch::NoGradGuard no_grad_guard;
+
+    torch::Tensor policy, value;
+    try
+    {
+        // A single request already is a contiguous slice of the submitters buffer, only merged requests get staged
+        torch::Tensor staged = batch[0]->input;
+        int offset = batch[0]->input_offset;
+        if (batch.size() > 1)
+        {
+            // Stage in the persistent input buffer, the copy is done once forward returned its outputs on the host
+            torch::ScalarType dtype = staged.scalar_type();
+            if (!batch_input.defined() || batch_input.size(0) < rows || batch_input.scalar_type() != dtype)
+            {
+                // Created once at full batch size, the first merged batch can come after the warm up rounds
+                AllocationCounter::Exempt staging;
+                std::vector<int64_t> sizes = staged.sizes().vec();
+                sizes[0] = std::max(rows, Config::maxBatchsize());
+                torch::TensorOptions options = torch::TensorOptions().device(Config::torchHostDevice()).dtype(dtype).requires_grad(false);
+                batch_input = torch::empty(sizes, options.pinned_memory(model->getDevice().is_cuda()));
+            }
+
+            // Gamestate buffers are contiguous on the host, rows are copied by offset without views
+            size_t row_bytes = size_t(batch_input.stride(0)) * c10::elementSize(dtype);
+            uint8_t* target = static_cast<uint8_t*>(batch_input.data_ptr());
+            for (InferenceRequest* request : batch)
+            {
+                const uint8_t* source = static_cast<const uint8_t*>(request->input.data_ptr());
+                memcpy(target, source + row_bytes * request->input_offset, row_bytes * request->rows);
+                target += row_bytes * request->rows;
+            }
+            staged = batch_input;
+            offset = 0;
+        }
+        InferenceBuffers& buffers = getOutputBuffers();
+
+        // Once per batch, not per node: the view of the batch rows, its copy to the device and forward allocate inside libtorch
+        AllocationCounter::Exempt library;
+        torch::Tensor model_input = staged.narrow(0, offset, rows).to(model->getDevice(), true);
+        std::tie(policy, value) = model->forward(model_input, std::get<0>(buffers), std::get<1>(buffers));
+    }
+    catch (const std::exception& e)
+    {
+        Log::log(LogLevel::ERROR, "Inference failed: " + std::string(e.what()), "INFERENCE");
+        for (InferenceRequest* request : batch)
+        {
+            request->error = std::current_exception();
+            complete(request);
+        }
+        return;
+    }
+
+    // Every request gets its own rows of the batch, as offset into the shared output
+    int offset = 0;
+    for (InferenceRequest* request : batch)
+    {
+        request->output = InferenceOutput{policy, value, offset};
+        offset += request->rows;
+        complete(request);
+    }
+}
+
+InferenceBuffers& InferenceServer::getOutputBuffers()
+{
+    // Rows handed out reference the storage of their batch until every consumer dropped them
+    for (InferenceBuffers& buffers : output_buffers)
+    {
+        auto& [policy, value] = buffers;
+        if (!policy.defined() || !value.defined())
+            return buffers;
+        if (policy.storage().use_count() == 1 && value.storage().use_count() == 1)
+            return buffers;
+    }
+
+    // Empty buffers get allocated by the model on the first batch
+    output_buffers.emplace_back();
+    return output_buffers.back();
+}
+
+void InferenceServer::complete(InferenceRequest* request)
+{
+    // The request can be reused as soon as it is done
+    InferenceCallback* callback = request->callback;
+    request->done.store(true, std::memory_order_release);
+    request->done.notify_one();
+
+    // The callback can resume whoever owns it, so nothing of it is touched after calling
+    if (callback && callback->remaining.fetch_sub(1) == 1)
+    {
+        std::function<void()> function = callback->function;
+        function();
+    }
+}
+
+void InferenceServer::recycle(InferenceRequest* request)
+{
+    // Drop the references, so the batch buffers can be reused
+    request->input = torch::Tensor();
+    request->output = InferenceOutput();
+    request->error = nullptr;
+
+    InferenceRequest* old_head = free_requests.load(std::memory_order_relaxed);
+    do
+        request->next = old_head;
+    while (!free_requests.compare_exchange_weak(old_head, request, std::memory_order_release, std::memory_order_relaxed));
+}
+
+const float* InferenceOutput::policyRow(int row)
+{
+    return policy.data_ptr<float>() + size_t(offset + row) * policy.stride(0);
+}
+
+float InferenceOutput::valueRow(int row)
+{
+    return value.data_ptr<float>()[size_t(offset + row) * value.stride(0)];
+}
+
+InferenceResult::InferenceResult(InferenceServer* server, InferenceRequest* request)
+    : server(server), request(request)
+{
+}
+
+InferenceResult::InferenceResult(InferenceResult&& other) noexcept
+    : server(other.server), request(other.request)
+{
+    other.request = nullptr;
+}
+
+InferenceResult::~InferenceResult()
+{
+    release();
+}
+
+InferenceOutput InferenceResult::get()
+{
+    request->done.wait(false, std::memory_order_acquire);
+    InferenceOutput output = std::move(request->output);
+    std::exception_ptr error = request->error;
+    release();
+
+    if (error)
+        std::rethrow_exception(error);
+    return output;
+}
+
+void InferenceResult::release()
+{
+    if (!request)
+        return;
+
+    request->done.wait(false, std::memory_order_acquire);
+    server->recycle(request);
+    request = nullptr;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "Config.h"
+#include "Model.h"
+#include "Log.h"
+#include "AllocationCounter.h"
+
+/*
+Owns all calls into one model.
+Producers submit blocks of gamestates and get results for the outputs, requests are pushed onto a lock free stack (MPSC).
+A request holds up to MaxBatchsize rows, so a block only costs one request per batch it fills.
+Requests are pooled by their server and handed back once their result was taken, so steady state submitting does not allocate.
+The server thread forms batches once MaxBatchsize rows are waiting or the oldest request
+waited longer than the inference deadline, so the deadline trades throughput for latency.
+Submitting wakes the server when it is idle or the rows fill a batch, otherwise it sleeps until the deadline.
+Batches of several requests are staged in a persistent input buffer, a single request goes to the model as it was submitted.
+The model writes into a pool of float output buffers.
+Requests only carry offsets into these buffers, so no tensor views are created per request or node.
+*/
+
+// Policy and value buffers the model writes a batch into
+typedef std::tuple<torch::Tensor, torch::Tensor> InferenceBuffers;
+
+// Rows of one request in the output buffers of its batch, starting at offset
+struct InferenceOutput
+{
+    torch::Tensor policy;
+    torch::Tensor value;
+    int offset = 0;
+
+    // Row of the request, only valid while this output keeps the batch alive
+    const float* policyRow(int row);
+    float valueRow(int row);
+};
+
+// Called from the server thread once the last of remaining requests is done, may free itself
+struct InferenceCallback
+{
+    std::atomic<int> remaining;
+    std::function<void()> function;
+};
+
+// Consecutive rows of one submitted block, the output holds the same rows
+struct InferenceRequest
+{
+    // Gamestate buffer of the submitter, the request covers rows starting at input_offset
+    torch::Tensor input;
+    int input_offset;
+    int rows;
+    InferenceOutput output;
+    // Set instead of output if inference failed
+    std::exception_ptr error;
+    // Set by the server once output or error is stored
+    std::atomic<bool> done;
+    std::chrono::steady_clock::time_point submitted;
+    InferenceCallback* callback;
+    InferenceRequest* next;
+};
+
+class InferenceServer;
+
+// Output of one request, like a future but its request goes back to the servers pool
+class InferenceResult
+{
+public:
+    InferenceResult(InferenceServer* server, InferenceRequest* request);
+    InferenceResult(InferenceResult&& other) noexcept;
+    InferenceResult(const InferenceResult&) = delete;
+    ~InferenceResult();
+
+    // Blocks until the output is ready, rethrows if inference failed, can only be called once
+    InferenceOutput get();
+
+private:
+    // Waits for the server to be done with the request before it is reused
+    void release();
+
+    InferenceServer* server;
+    InferenceRequest* request;
+};
+
+class InferenceServer
+{
+public:
+    InferenceServer(Model* model);
+    ~InferenceServer();
+
+    // The first count rows of gamestates are split in requests of at most MaxBatchsize rows, their results get appended in row order
+    // Every request counts down callback, submit adds them to remaining before they can complete
+    void submit(torch::Tensor gamestates, int count, std::vector<InferenceResult>& results, InferenceCallback* callback = nullptr);
+
+    Model* getModel();
+
+    // Returns a done request to the pool, safe from any thread
+    void recycle(InferenceRequest* request);
+
+private:
+    void serve();
+    void runBatch(std::vector<InferenceRequest*>& batch, int rows);
+    void notifyServer();
+    // Output buffers no earlier batch is still referenced from
+    InferenceBuffers& getOutputBuffers();
+    // Marks request done after its output was set
+    static void complete(InferenceRequest* request);
+
+    Model* model;
+
+    // Newest request first, the server takes the whole stack at once
+    std::atomic<InferenceRequest*> head;
+    // Pool of done requests, submitting takes the whole stack at once so requests are never popped twice
+    std::atomic<InferenceRequest*> free_requests;
+    // Rows submitted but not batched yet, decides when submitting has to wake the server
+    std::atomic<int> queued_rows;
+    std::atomic<bool> running;
+    // Only guards the sleep of the server, submitting takes it just to notify
+    std::mutex wakeup_mutex;
+    std::condition_variable wakeup;
+    std::thread thread;
+
+    // Kept for the servers lifetime, only touched by the server thread
+    torch::Tensor batch_input;
+    std::deque<InferenceBuffers> output_buffers;
+};
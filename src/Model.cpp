@@ -28,7 +28,7 @@ Model::Model(std::string resnet_path, std::string polhead_path, std::string valh
 {   }
 
 Model::Model(std::string resnet_path, std::string polhead_path, std::string valhead_path, int simulations, std::string name)
-    : model_name(name), simulations(simulations), device(Config::torchInferenceDevice()), dtype(Config::torchScalar())
+    : model_name(name), simulations(simulations), leaf_batch(Config::defaultLeafBatch()), device(Config::torchInferenceDevice()), dtype(Config::torchScalar()), fused(false)
 {
     // Load resnet
     try
@@ -59,31 +59,101 @@ Model::Model(std::string resnet_path, std::string polhead_path, std::string valh
     {
         Log::log(LogLevel::FATAL, "Could not load valuehead from: " + valhead_path, "MODEL");
     }
+
+    if (Config::fuseModels())
+        fuse();
+}
+
+void Model::fuse()
+{
+    fused = false;
+
+    // Disable gradients for this scope
+    torch::NoGradGuard no_grad_guard;
+
+    try
+    {
+        // One module for all parts, so a batch is a single call into the interpreter and the softmax is part of the graph
+        torch::jit::script::Module combined("FusedModel");
+        combined.register_module("resnet", resnet);
+        combined.register_module("polhead", polhead);
+        combined.register_module("valhead", valhead);
+        combined.define(R"(
+def forward(self, input):
+    features = self.resnet(input)
+    return torch.softmax(self.polhead(features), -1), self.valhead(features)
+)");
+        combined.eval();
+
+        // Weights match the channels last input, on a copy so the separate modules keep their layout
+        torch::jit::script::Module channels_last = combined.clone();
+        for (torch::Tensor parameter : channels_last.parameters())
+            if (parameter.dim() == 4)
+                parameter.set_data(parameter.contiguous(torch::MemoryFormat::ChannelsLast));
+
+        // Freezing inlines the weights and folds batchnorms into their convolutions,
+        // then conv/add/relu chains get fused for the backend
+        torch::jit::script::Module frozen = torch::jit::freeze(channels_last);
+        fused_module = torch::jit::optimize_for_inference(frozen);
+        fused = true;
+    }
+    catch (const std::exception& e)
+    {
+        Log::log(LogLevel::WARNING, "Could not fuse " + model_name + ", running separate modules: " + std::string(e.what()), "MODEL");
+    }
 }
 
 
-std::tuple<torch::Tensor, torch::Tensor> Model::forward(torch::Tensor input)
+std::tuple<torch::Tensor, torch::Tensor> Model::forward(torch::Tensor input, torch::Tensor& policy, torch::Tensor& value)
 {
     // Disable gradients for this scope
     torch::NoGradGuard no_grad_guard;
 
-    // Inference
-    auto resnet_result = resnet.forward({input});
-    auto policy_result = polhead.forward({resnet_result});
-    auto value_result = valhead.forward({resnet_result});
+    // Compact input (Config::compactInput) is already on the device, widen it right before the first convolution
+    if (input.scalar_type() != dtype)
+        input = input.to(dtype);
 
     // Extract policy and value outputs
-    torch::Tensor policy_output = policy_result.toTensor();
-    torch::Tensor value_output = value_result.toTensor();
-    policy_output = torch::softmax(policy_output, -1);
-    policy_output = policy_output.to(Config::torchHostDevice());
-    value_output = value_output.to(Config::torchHostDevice());
+    torch::Tensor policy_output, value_output;
+    if (fused)
+    {
+        // Convolutions of the fused module run in channels last
+        auto outputs = fused_module.forward({input.contiguous(torch::MemoryFormat::ChannelsLast)}).toTuple();
+        policy_output = outputs->elements()[0].toTensor();
+        value_output = outputs->elements()[1].toTensor();
+    }
+    else
+    {
+        // Inference
+        auto resnet_result = resnet.forward({input});
+        auto policy_result = polhead.forward({resnet_result});
+        auto value_result = valhead.forward({resnet_result});
 
-    // Detach for grad safety
-    policy_output = policy_output.detach();
-    value_output = value_output.detach();
+        policy_output = torch::softmax(policy_result.toTensor(), -1);
+        value_output = value_result.toTensor();
+    }
+
+    return std::tuple<torch::Tensor, torch::Tensor>(writeOutput(policy_output, policy), writeOutput(value_output, value));
+}
+
+torch::Tensor Model::writeOutput(torch::Tensor output, torch::Tensor& buffer)
+{
+    int64_t rows = output.size(0);
+    // Float regardless of the model precision, so consumers read rows through raw pointers
+    bool fits = buffer.defined() && buffer.size(0) >= rows && buffer.scalar_type() == torch::kFloat32
+        && buffer.sizes().slice(1) == output.sizes().slice(1);
+    if (!fits)
+    {
+        std::vector<int64_t> sizes = output.sizes().vec();
+        sizes[0] = std::max<int64_t>(rows, Config::maxBatchsize());
+        torch::TensorOptions options = torch::TensorOptions().device(Config::torchHostDevice()).dtype(torch::kFloat32).requires_grad(false);
+        buffer = torch::empty(sizes, options.pinned_memory(device.is_cuda()));
+    }
 
-    return std::tuple<torch::Tensor, torch::Tensor>(policy_output, value_output);
+    // Copy also moves the output to the host and widens it to float, rows are detached from the graph
+    torch::Tensor batch_rows = buffer.narrow(0, 0, rows);
+    batch_rows.copy_(output);
+    return batch_rows;
 }
 
 void Model::setDevice(torch::Device device)
@@ -92,6 +162,10 @@ void Model::setDevice(torch::Device device)
     resnet.to(device);
     valhead.to(device);
     polhead.to(device);
+
+    // Frozen weights are constants of the fused graph and do not move with the module
+    if (fused)
+        fuse();
 }
 
 torch::Device Model::getDevice()
@@ -105,6 +179,9 @@ void Model::setPrec(torch::ScalarType type)
     resnet.to(type);
     valhead.to(type);
     polhead.to(type);
+
+    if (fused)
+        fuse();
 }
 
 torch::ScalarType Model::getPrec()
@@ -140,6 +217,16 @@ int Model::getSimulations()
     return simulations;
 }
 
+void Model::setLeafBatch(int leaves)
+{
+    leaf_batch = std::max(1, leaves);
+}
+
+int Model::getLeafBatch()
+{
+    return leaf_batch;
+}
+
 Model* Model::autoloadModel(std::string name)
 {
     return autoloadModel(name, Config::defaultSimulations());
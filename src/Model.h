@@ -22,7 +22,9 @@ public:
     Model(std::string resnet_path, std::string polhead_path, std::string valhead_path, std::string name);
     Model(std::string resnet_path, std::string polhead_path, std::string valhead_path);
 
-    std::tuple<torch::Tensor, torch::Tensor> forward(torch::Tensor input);
+    // Writes the outputs as float into policy and value on the host, which are only (re)allocated when the batch does not fit
+    // Returns the rows of the batch
+    std::tuple<torch::Tensor, torch::Tensor> forward(torch::Tensor input, torch::Tensor& policy, torch::Tensor& value);
     
     // Name config
     void setName(std::string);
@@ -40,6 +42,10 @@ public:
     void setSimulations(int simulations);
     int getSimulations();
 
+    // Leaves per tree and network call
+    void setLeafBatch(int leaves);
+    int getLeafBatch();
+
     // Creates a model from just the model name, takes rest from config path with 400 sims
     static Model* autoloadModel(std::string name);
 
@@ -48,12 +54,20 @@ public:
 
 private:
     torch::jit::script::Module load_module(std::string path);
+    // Combine resnet and heads into one frozen module optimized for inference (Config::fuseModels)
+    void fuse();
+    // Copy output into the first rows of buffer, grows it to at least MaxBatchsize rows
+    torch::Tensor writeOutput(torch::Tensor output, torch::Tensor& buffer);
 
     std::string model_name;
     int simulations;
+    int leaf_batch;
 
     torch::Device device;
     torch::ScalarType dtype;
 
     torch::jit::script::Module resnet, polhead, valhead;
+    // Used instead of the separate modules once fused
+    bool fused;
+    torch::jit::script::Module fused_module;
 };
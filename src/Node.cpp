@@ -5,17 +5,118 @@
 
 #include "Node.h"
 
-Node::Node(State* state, Node* parent)
-    : parent(parent), state(state), network_status(0)
+static bool inMask(const MoveMask& mask, index_t move)
+{
+    return mask[move / 64] & (uint64_t(1) << (move % 64));
+}
+
+void CompactPolicy::store(const float* policy, const MoveMask& moves)
+{
+    legal = moves;
+    int count = 0;
+    for (uint64_t word : legal)
+        count += std::popcount(word);
+
+    dtype = Config::priorScalar();
+    size_t element_size = dtype == torch::kFloat32 ? sizeof(float) : (dtype == torch::kFloat16 ? sizeof(c10::Half) : sizeof(uint8_t));
+    data.resize(count * element_size);
+
+    scale = 0.0f;
+    if (dtype == torch::kUInt8)
+        for (index_t i = 0; i < BoardSize * BoardSize; i++)
+            if (inMask(legal, i))
+                scale = std::max(scale, policy[i]);
+
+    int slot = 0;
+    for (index_t i = 0; i < BoardSize * BoardSize; i++)
+    {
+        if (!inMask(legal, i))
+            continue;
+
+        if (dtype == torch::kFloat32)
+            reinterpret_cast<float*>(data.data())[slot] = policy[i];
+        else if (dtype == torch::kFloat16)
+            reinterpret_cast<c10::Half*>(data.data())[slot] = c10::Half(policy[i]);
+        else
+            data[slot] = scale > 0.0f ? uint8_t(std::lround(policy[i] / scale * 255.0f)) : 0;
+        slot++;
+    }
+}
+
+bool CompactPolicy::isLegal(index_t move)
+{
+    return inMask(legal, move);
+}
+
+int CompactPolicy::slot(index_t move)
+{
+    int rank = 0;
+    for (int word = 0; word < move / 64; word++)
+        rank += std::popcount(legal[word]);
+    return rank + std::popcount(legal[move / 64] & ((uint64_t(1) << (move % 64)) - 1));
+}
+
+float CompactPolicy::get(index_t move)
+{
+    return at(slot(move));
+}
+
+float CompactPolicy::at(int slot)
+{
+    if (dtype == torch::kFloat32)
+        return reinterpret_cast<float*>(data.data())[slot];
+    if (dtype == torch::kFloat16)
+        return float(reinterpret_cast<c10::Half*>(data.data())[slot]);
+    return data[slot] * scale / 255.0f;
+}
+
+// Statistics can be shared by several threads (tree parallel search), relaxed loads are plain loads
+template <typename T>
+static T loadStat(T& stat)
+{
+    return std::atomic_ref<T>(stat).load(std::memory_order_relaxed);
+}
+
+template <typename T>
+static void addStat(T& stat, T amount)
+{
+    std::atomic_ref<T>(stat).fetch_add(amount, std::memory_order_relaxed);
+}
+
+template <typename T, typename... Args>
+T* Node::allocate(Args&&... args)
+{
+    if (arena)
+        return arena->create<T>(std::forward<Args>(args)...);
+    return new T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void Node::release(T* object)
+{
+    if (arena)
+        arena->destroy(object);
+    else
+        delete object;
+}
+
+Node::Node(State* state, Node* parent, Arena* arena)
+    : parent(parent), state(state), parent_edge(index_t(-1)),
+      move(state->last), empty(state->empty), result(state->getResult()), hash(state->getHash()), expanding(false), fully_expanded(false), edge_count(0), temp_data(nullptr), arena(arena),
+      network_status(0), virtual_loss(false), shrunk(false)
 {
-    temp_data = new NodeData();
-    temp_data->untried_actions = state->getPossible();
-    temp_data->visits = 0;
-    temp_data->summed_evaluation = 0.0f;
+    legal.fill(0);
+    for (index_t i = 0; i < BoardSize * BoardSize; i++)
+        if (state->isCellEmpty(i))
+            legal[i / 64] |= uint64_t(1) << (i % 64);
 }
 
+Node::Node(State* state, Node* parent)
+    : Node(state, parent, parent ? parent->arena : nullptr)
+{   }
+
 Node::Node(State* state)
-    : Node(state, nullptr)
+    : Node(state, nullptr, nullptr)
 {   }
 
 Node::Node()
@@ -24,26 +125,116 @@ Node::Node()
 
 Node::~Node()
 {
-    delete state;
-    delete temp_data;
+    release(state);
+    releaseData();
 
-    // Recursively delete all children
+    // Recursively delete all children, shared children are only deleted by their owner
     for (Node* child : children)
-        delete child;
+        if (child->parent == this)
+            destroy(child);
+}
+
+void Node::destroy(Node* node)
+{
+    if (node->arena)
+        node->arena->destroy(node);
+    else
+        delete node;
 }
 
 void Node::reset()
 {
-    temp_data->untried_actions = state->getPossible();
-    for (Node* child : children)
-        delete child;
+    // In graph search the tree owns all nodes and frees unreachable ones itself
+    if (!Config::graphSearch())
+        for (Node* child : children)
+            destroy(child);
     children.clear();
+    child_actions.clear();
+    edge_count.store(0);
+    fully_expanded.store(false);
+
+    if (temp_data)
+    {
+        // Every legal move is untried again
+        release(temp_data->expansion);
+        temp_data->expansion = nullptr;
+        temp_data->edge_priors.clear();
+        temp_data->edge_visits.clear();
+        temp_data->edge_values.clear();
+    }
 }
 
-void Node::deleteState()
+void Node::restoreState(State* parent_state)
 {
-    delete state;
-    state = nullptr;
+    if (state)
+        return;
+
+    state = allocate<State>(parent_state);
+    state->makeMove(move);
+}
+
+NodeData* Node::getData()
+{
+    NodeData* data = std::atomic_ref<NodeData*>(temp_data).load(std::memory_order_acquire);
+    if (data)
+        return data;
+
+    data = allocate<NodeData>();
+    data->expansion = nullptr;
+    data->history = nullptr;
+    data->visits = 0;
+    data->evaluation = 0.0f;
+    data->summed_evaluation = 0.0f;
+
+    // Terminal leaves can be backpropagated by several threads at once (tree parallel search)
+    NodeData* expected = nullptr;
+    if (!std::atomic_ref<NodeData*>(temp_data).compare_exchange_strong(expected, data, std::memory_order_acq_rel))
+    {
+        release(data);
+        return expected;
+    }
+    return data;
+}
+
+ExpansionData* Node::getExpansionData()
+{
+    NodeData* data = getData();
+    if (data->expansion)
+        return data->expansion;
+
+    ExpansionData* expansion = allocate<ExpansionData>();
+    expansion->ordered = false;
+    // Every empty cell, kept on the node so stateless nodes need no state
+    for (index_t i = 0; i < BoardSize * BoardSize; i++)
+        if (inMask(legal, i))
+            expansion->untried.set(i);
+
+    // Every child this node can get, so publishing an edge never moves the ones other threads are reading
+    if (Config::treeParallel())
+    {
+        size_t capacity = children.size() + expansion->untried.count();
+        #if BranchingLimit > 0
+        capacity = std::min(capacity, size_t(BranchingLimit + 1));
+        #endif
+        children.reserve(capacity);
+        child_actions.reserve(capacity);
+        data->edge_priors.reserve(capacity);
+        data->edge_visits.reserve(capacity);
+        data->edge_values.reserve(capacity);
+    }
+
+    data->expansion = expansion;
+    return expansion;
+}
+
+void Node::releaseData()
+{
+    if (temp_data)
+    {
+        release(temp_data->expansion);
+        release(temp_data->history);
+    }
+    release(temp_data);
 }
 
 float Node::getValueHeadEval()
@@ -52,7 +243,9 @@ float Node::getValueHeadEval()
         return temp_data->evaluation;
     else
     {
-        Log::log(LogLevel::ERROR, "Tried to get value head eval from shrunk node", "NODE");
+        // Unvisited nodes have not been evaluated yet
+        if (shrunk)
+            Log::log(LogLevel::ERROR, "Tried to get value head eval from shrunk node", "NODE");
         return 0;
     }
 }
@@ -60,10 +253,11 @@ float Node::getValueHeadEval()
 float Node::getSummedEvaluation()
 {
     if (temp_data)
-        return temp_data->summed_evaluation;
+        return loadStat(temp_data->summed_evaluation);
     else
     {
-        Log::log(LogLevel::ERROR, "Tried to get summed value from shrunk node", "NODE");
+        if (shrunk)
+            Log::log(LogLevel::ERROR, "Tried to get summed value from shrunk node", "NODE");
         return 0;
     }
 }
@@ -71,10 +265,11 @@ float Node::getSummedEvaluation()
 uint32_t Node::getVisits()
 {
     if (temp_data)
-        return temp_data->visits;
+        return loadStat(temp_data->visits);
     else
     {
-        Log::log(LogLevel::ERROR, "Tried to get visits from shrunk node", "NODE");
+        if (shrunk)
+            Log::log(LogLevel::ERROR, "Tried to get visits from shrunk node", "NODE");
         return 0;
     }
 }
@@ -84,10 +279,7 @@ float Node::getPolicyValue(index_t move)
     if (network_status)
     {
         if (temp_data)
-        {
-            torch::NoGradGuard no_grad_guard;
-            return temp_data->policy_evaluations[move].item<float>();
-        }
+            return temp_data->policy_evaluations.get(move);
         else
         {
             Log::log(LogLevel::ERROR, "Tried to get policy value form shrunk node", "NODE");
@@ -107,57 +299,119 @@ bool Node::isFullyExpanded()
         return true;
     // Adds possibility to clamp exploration to n best initial guesses
     #if BranchingLimit > 0
-    if (children.size() > BranchingLimit || getUntriedActions().size() == 0)
+    if (children.size() > BranchingLimit || getUntriedCount() == 0)
         return true;
     #else
-    if (getUntriedActions().size() == 0)
+    if (getUntriedCount() == 0)
         return true;
     #endif
     return false;
 }
 
-std::vector<index_t>& Node::getUntriedActions()
+std::vector<index_t> Node::getUntriedActions()
 {
-    if (temp_data)
-        return temp_data->untried_actions;
+    if (!shrunk)
+    {
+        // Until the first expansion every empty cell is untried
+        ExpansionData* expansion = temp_data ? temp_data->expansion : nullptr;
+        std::vector<index_t> actions;
+        actions.reserve(expansion ? expansion->untried.count() : empty);
+        for (index_t i = 0; i < BoardSize * BoardSize; i++)
+            if (expansion ? expansion->untried.test(i) : inMask(legal, i))
+                actions.push_back(i);
+        return actions;
+    }
     else
     {
         Log::log(LogLevel::ERROR, "Tried to get untried actions from shrunk node", "NODE");
-        // Will crash but whatever
-        return temp_data->untried_actions;
+        return std::vector<index_t>();
+    }
+}
+
+int Node::getUntriedCount()
+{
+    if (!shrunk)
+        return temp_data && temp_data->expansion ? temp_data->expansion->untried.count() : empty;
+    else
+    {
+        Log::log(LogLevel::ERROR, "Tried to get untried actions from shrunk node", "NODE");
+        return 0;
     }
 }
 
 index_t Node::getParentAction()
 {
     if (parent)
-        return state->last;
+        return move;
     else
         return index_t(-1);
 }
 
+index_t Node::getActionTo(Node* child)
+{
+    int edge = getEdgeIndex(child);
+    if (edge != -1)
+        return child_actions[edge];
+
+    Log::log(LogLevel::ERROR, "Tried to get action to node which is not a child", "NODE");
+    return index_t(-1);
+}
+
+int Node::getEdgeIndex(Node* child)
+{
+    if (child->parent == this)
+        return child->parent_edge;
+
+    // Shared child, only possible in graph search
+    for (size_t i = 0; i < children.size(); i++)
+        if (children[i] == child)
+            return i;
+    return -1;
+}
+
 void Node::shrinkNode()
 {
-    delete temp_data;
+    releaseData();
     temp_data = nullptr;
+    shrunk = true;
     children.shrink_to_fit();
 }
 
 bool Node::isShrunk()
 {
-    return temp_data == nullptr;
+    return shrunk;
 }
 
 void Node::removeNodeFromChildren(Node* node)
 {
-    Utils::eraseFromVector(children, node);
+    int edge = getEdgeIndex(node);
+    if (edge == -1)
+        return;
+
+    children.erase(children.begin() + edge);
+    child_actions.erase(child_actions.begin() + edge);
+    edge_count.store(children.size());
+    if (temp_data)
+    {
+        temp_data->edge_priors.erase(temp_data->edge_priors.begin() + edge);
+        temp_data->edge_visits.erase(temp_data->edge_visits.begin() + edge);
+        temp_data->edge_values.erase(temp_data->edge_values.begin() + edge);
+    }
+
+    // Following owned children moved down by one
+    for (size_t i = edge; i < children.size(); i++)
+        if (children[i]->parent == this)
+            children[i]->parent_edge = i;
     // TODO Maybe obsolete ?
     children.shrink_to_fit();
 }
 
 StateColor Node::getNextColor()
 {
-    return state->getNextColor();
+    // Same as State::getNextColor
+    if (empty % 2)
+        return StateColor::BLACK;
+    return StateColor::WHITE;
 }
 
 float Node::getNodesPolicyEval()
@@ -171,84 +425,190 @@ float Node::getNodesPolicyEval()
     }
 }
 
-void Node::setModelOutput(torch::Tensor policy, torch::Tensor value)
+void Node::setModelOutput(const float* policy, float value)
 {
-    if (temp_data == nullptr)
+    if (shrunk)
     {
         Log::log(LogLevel::ERROR, "Tried to assign net data to shrunk node", "NODE");
         return;
     }
-    // Disable gradients for this scope
-    torch::NoGradGuard no_grad_guard;
 
     // Assign value
-    float evaluation = value.item<float>();
+    float evaluation = value;
     // Normaize for black is -1 white +1
     if (getNextColor() == StateColor::BLACK)
         evaluation *= -1;
 
-    temp_data->evaluation = evaluation;
+    NodeData* data;
+    {
+        // Search data and priors of the node grow the tree, they are not per round overhead
+        AllocationCounter::Exempt tree_memory;
+        data = getData();
+        data->evaluation = evaluation;
 
-    // Store policy values
-    temp_data->policy_evaluations = policy;
+        // Store priors of legal moves only, so the batch output is not kept alive
+        data->policy_evaluations.store(policy, legal);
+    }
 
     // Tell node that it has network data
     network_status = true;
 
-    // Inital backprop
-    callBackpropagate();
+    // Children expanded before netdata arrived have no prior yet
+    for (size_t i = 0; i < children.size(); i++)
+        data->edge_priors[i] = getPolicyValue(child_actions[i]);
+
+    // Parents planes are only needed to encode its children, which are all evaluated once it is fully expanded
+    if (parent && parent->temp_data && parent->temp_data->history && parent->isFullyExpanded())
+        parent->releaseHistoryPlanes();
+
+    // Inital backprop, in graph search the tree backpropagates along the selected path
+    if (!Config::graphSearch())
+        callBackpropagate();
 }
 
 void Node::removeFromUntried(index_t action)
 {
-    std::vector<index_t>& untried = getUntriedActions();
-    Utils::eraseFromVector(untried, action);
+    ExpansionData* expansion = getExpansionData();
+    expansion->untried.reset(action);
+    // Auto expansion always takes the last (highest prior) action
+    if (!expansion->order.empty() && expansion->order.back() == action)
+        expansion->order.pop_back();
 }
 
-Node* Node::expand()
+Node* Node::expand(State* running_state)
+{
+    index_t action = getNextAction();
+    if (action == index_t(-1))
+        return nullptr;
+
+    return expand(action, running_state);
+}
+
+index_t Node::getNextAction()
 {
     if (!network_status)
     {
         Log::log(LogLevel::ERROR, "Tried to auto expand node without policy data", "NODE");
-        return nullptr;
+        return index_t(-1);
     }
 
-    if (!temp_data)
+    if (shrunk)
     {
         Log::log(LogLevel::ERROR, "Tried to auto expand shrunk node", "NODE");
-        return nullptr;
+        return index_t(-1);
     }
 
+    AllocationCounter::Exempt tree_memory;
+    ExpansionData* expansion = getExpansionData();
+    std::vector<index_t>& order = expansion->order;
 
-    // Find highest policy action
-    index_t action = -1; // initialized as unreachable value
-    float action_val = 0;
-    for (index_t possible : getUntriedActions())
+    // Order untried actions by prior once, best last, so expansion pops in O(1)
+    if (!expansion->ordered)
     {
-        float policy_val = getPolicyValue(possible);
-        if (action == index_t(-1) || action_val < policy_val)
+        std::array<float, BoardSize * BoardSize> priors;
+        order.reserve(expansion->untried.count());
+        int slot = 0;
+        for (index_t i = 0; i < BoardSize * BoardSize; i++)
         {
-            action_val = policy_val;
-            action = possible;
+            if (!temp_data->policy_evaluations.isLegal(i))
+                continue;
+            priors[i] = temp_data->policy_evaluations.at(slot++);
+            if (expansion->untried.test(i))
+                order.push_back(i);
         }
+        std::stable_sort(order.begin(), order.end(), [&priors](index_t a, index_t b) {
+            return priors[a] < priors[b];
+        });
+        expansion->ordered = true;
     }
 
-    return expand(action);
+    // Skip actions that were expanded manually in the meantime
+    while (!order.empty() && !expansion->untried.test(order.back()))
+        order.pop_back();
+
+    if (order.empty())
+        return index_t(-1);
+    return order.back();
 }
 
-Node* Node::expand(index_t action)
+Node* Node::expand(index_t action, State* running_state)
 {
+    State* source_state = state ? state : running_state;
+    if (source_state == nullptr)
+    {
+        Log::log(LogLevel::ERROR, "Tried to expand stateless node without running state", "NODE");
+        return nullptr;
+    }
+
+    // Memory of new nodes grows the tree, it is not per round overhead
+    AllocationCounter::Exempt tree_memory;
     removeFromUntried(action);
 
-    State* resulting_state = new State(state);
-    resulting_state->makeMove(action);
-    Node* child = new Node(resulting_state, this);
+    // The children get encoded from these planes, parents in graph search can change so they derive nothing
+    NodeData* data = getData();
+    if (!data->history && Config::historyDepth() <= HistoryDepth && !Config::graphSearch())
+    {
+        data->history = allocate<HistoryPlanes>();
+        buildHistoryPlanes(data->history->planes[0], source_state);
+    }
 
-    children.push_back(child);
+    Node* child;
+    if (Config::statelessNodes())
+    {
+        // The child only keeps what it needs of its position, so its state is made on the stack
+        State resulting_state(source_state);
+        resulting_state.makeMove(action);
+        child = allocate<Node>(&resulting_state, this);
+        child->state = nullptr;
+    }
+    else
+    {
+        State* resulting_state = allocate<State>(source_state);
+        resulting_state->makeMove(action);
+        child = allocate<Node>(resulting_state, this);
+    }
+
+    child->parent_edge = children.size();
+    addEdge(action, child);
 
     return child;
 }
 
+void Node::link(index_t action, Node* child)
+{
+    removeFromUntried(action);
+    addEdge(action, child);
+}
+
+void Node::adopt(Node* child)
+{
+    int edge = getEdgeIndex(child);
+    if (edge == -1)
+    {
+        Log::log(LogLevel::ERROR, "Tried to adopt node which is not a child", "NODE");
+        return;
+    }
+
+    child->parent = this;
+    child->parent_edge = edge;
+    // Move history follows the owning parent
+    child->move = child_actions[edge];
+}
+
+void Node::addEdge(index_t action, Node* child)
+{
+    children.push_back(child);
+    child_actions.push_back(action);
+    // Manual expansions can happen before netdata arrived, prior gets filled in setModelOutput
+    NodeData* data = getData();
+    data->edge_priors.push_back(network_status ? getPolicyValue(action) : 0.0f);
+    data->edge_visits.push_back(0);
+    data->edge_values.push_back(0.0f);
+
+    // Edge is complete before selection can see it
+    edge_count.store(children.size(), std::memory_order_release);
+}
+
 void Node::callBackpropagate()
 {
     if (!getNetworkStatus())
@@ -263,33 +623,52 @@ void Node::callBackpropagate()
 
 Node* Node::bestChild()
 {
-    Node* best_child = nullptr;
+    int edge = bestEdge();
+    if (edge == -1)
+        return nullptr;
+    return children[edge];
+}
+
+int Node::bestEdge()
+{
+    int best_edge = -1;
     float best_result = -100.0;
-    float log_visits = 2 * std::log(getVisits());
     float result, value, exploration, policy;
 
-    // Get child with best value
-    for (Node* child : children)
+    const int edges = edge_count.load(std::memory_order_acquire);
+    float* priors = temp_data->edge_priors.data();
+    uint32_t* visits = temp_data->edge_visits.data();
+    float* values = temp_data->edge_values.data();
+
+    // Hoisted out of the loop, children all have the opposite color of this node
+    const float log_visits = 2 * std::log(getVisits());
+    const float value_bias = Config::valueBias() * (getNextColor() == StateColor::BLACK ? -1.0f : 1.0f);
+    const float exploration_bias = Config::explorationBias();
+    const float policy_bias = Config::policyBias();
+
+    // Get edge with best value
+    for (int i = 0; i < edges; i++)
     {
-        // Calculate value
-        value = Config::valueBias() * child->getMeanEvaluation();
-        exploration = Config::explorationBias() * std::sqrt(log_visits / float(child->getVisits()));
-        policy = Config::policyBias() * child->getNodesPolicyEval();
+        float edge_visits = float(loadStat(visits[i]));
+        // Unvisited edges get infinite exploration, same as before
+        value = value_bias * loadStat(values[i]) / std::max(edge_visits, 1.0f);
+        exploration = exploration_bias * std::sqrt(log_visits / edge_visits);
+        policy = policy_bias * loadStat(priors[i]);
         result = value + exploration + policy;
 
         if (result > best_result)
         {
             best_result = result;
-            best_child = child;
+            best_edge = i;
         }
     }
 
-    return best_child;
+    return best_edge;
 }
 
 bool Node::isTerminal()
 {
-    return state->isTerminal();
+    return result != StateResult::NONE;
 }
 
 bool Node::getNetworkStatus()
@@ -327,7 +706,7 @@ Node* Node::absBestChild()
 
 StateResult Node::getResult()
 {
-    return state->getResult();
+    return result;
 }
 
 float Node::getProcessedEval()
@@ -357,15 +736,76 @@ float Node::getMeanEvaluation()
         return getSummedEvaluation() / getVisits();
 }
 
+void Node::addVisit(float eval)
+{
+    NodeData* data = getData();
+    addStat(data->visits, uint32_t(1));
+    addStat(data->summed_evaluation, eval);
+}
+
+void Node::addEdgeVisit(int edge, float eval)
+{
+    addStat(temp_data->edge_visits[edge], uint32_t(1));
+    addStat(temp_data->edge_values[edge], eval);
+}
+
+void Node::addVirtualLoss(int edge, int count)
+{
+    // Worst value as seen by bestEdge
+    float loss = getNextColor() == StateColor::BLACK ? 1.0f : -1.0f;
+    addStat(temp_data->visits, uint32_t(count));
+    addStat(temp_data->edge_visits[edge], uint32_t(count));
+    addStat(temp_data->edge_values[edge], count * loss);
+}
+
+bool Node::hasVirtualLoss()
+{
+    return virtual_loss;
+}
+
+void Node::setVirtualLoss(bool pending)
+{
+    virtual_loss = pending;
+}
+
+float Node::getEdgePrior(int edge)
+{
+    return loadStat(temp_data->edge_priors[edge]);
+}
+
+void Node::setEdgePrior(int edge, float prior)
+{
+    std::atomic_ref<float>(temp_data->edge_priors[edge]).store(prior, std::memory_order_relaxed);
+}
+
+bool Node::claimExpansion()
+{
+    bool expected = false;
+    return expanding.compare_exchange_strong(expected, true, std::memory_order_acquire);
+}
+
+void Node::releaseExpansion()
+{
+    if (isFullyExpanded())
+        fully_expanded.store(true, std::memory_order_release);
+    expanding.store(false, std::memory_order_release);
+}
+
+bool Node::isExpansionDone()
+{
+    return fully_expanded.load(std::memory_order_acquire);
+}
+
 void Node::backpropagate(float eval)
 {
-    temp_data->visits++;
-    temp_data->summed_evaluation += eval;
+    addVisit(eval);
 
     // Stop at root
-    if (parent)
-        if (!parent->isShrunk())
-            parent->backpropagate(eval);
+    for (Node* node = this; node->parent && !node->parent->isShrunk(); node = node->parent)
+    {
+        node->parent->addEdgeVisit(node->parent_edge, eval);
+        node->parent->addVisit(eval);
+    }
 }
 
 float Node::valueProcessor(float normalized_value)
@@ -400,6 +840,26 @@ std::vector<index_t> Node::getMoveHistory()
     return history;
 }
 
+uint64_t Node::getHistoryHash()
+{
+    uint64_t history_hash = hash;
+
+    // Same walk as nodeToGamestate, missing moves before the root get their own key
+    Node* running_node = this;
+    for (int i = 0; i < Config::historyDepth() - 2; i++)
+    {
+        if (running_node == nullptr)
+            history_hash ^= State::historyKey(i, index_t(-1));
+        else
+        {
+            history_hash ^= State::historyKey(i, running_node->getParentAction());
+            running_node = running_node->parent;
+        }
+    }
+
+    return history_hash;
+}
+
 torch::Tensor Node::nodeToGamestate(Node* node)
 {
     return nodeToGamestate(node, Config::torchScalar());
@@ -412,105 +872,217 @@ torch::Tensor Node::nodeToGamestate(Node* node, torch::ScalarType dtype)
 
     // Generate Tensor on CPU
     torch::TensorOptions default_tensor_options = torch::TensorOptions().device(Config::torchHostDevice()).dtype(dtype).requires_grad(false);
+    torch::Tensor tensor = torch::empty({Config::historyDepth() + 1, BoardSize, BoardSize}, default_tensor_options);
 
-    // Init main tensor
-    torch::Tensor tensor = torch::zeros({Config::historyDepth() + 1, 15, 15}, default_tensor_options);
-
-    // State at node
-    State* current_state = node->state;
+    writeGamestate(node, tensor.data_ptr(), dtype);
+    return tensor;
+}
 
-    // Next color tensor
-    torch::Tensor next_color;
+// Bit y of rows[x] is the cell at x, y, same layout as the rotated boards of State
+template <typename T>
+static void writePlane(T* plane, const BLOCK* rows)
+{
+    for (int x = 0; x < BoardSize; x++)
+        for (int y = 0; y < BoardSize; y++)
+            plane[x * BoardSize + y] = T(float((rows[x] >> y) & 1));
+}
 
-    if (node->getNextColor() == StateColor::WHITE)
-        next_color = torch::ones({BoardSize, BoardSize}, default_tensor_options);
+void Node::writeGamestate(Node* node, void* target, torch::ScalarType dtype)
+{
+    if (dtype == torch::kFloat32)
+        writeGamestatePlanes(node, static_cast<float*>(target));
+    else if (dtype == torch::kFloat16)
+        writeGamestatePlanes(node, static_cast<c10::Half*>(target));
+    else if (dtype == torch::kUInt8)
+        writeGamestatePlanes(node, static_cast<uint8_t*>(target));
     else
-        next_color = torch::zeros({BoardSize, BoardSize}, default_tensor_options);
-
-    tensor[0] = next_color;
-
-    // Get last actions from source
-    std::vector<index_t> move_history;
-    move_history.reserve(Config::historyDepth() - 2);
+        Log::log(LogLevel::ERROR, "Unsupported gamestate scalar type", "NODE");
+}
 
-    Node* running_node = node; 
-    for (index_t i = 0; i < Config::historyDepth() - 2; i++)
+template <typename T>
+void Node::writeGamestatePlanes(Node* node, T* target)
+{
+    int plane_size = BoardSize * BoardSize;
+    int history_depth = Config::historyDepth();
+
+    // Next color plane
+    std::fill(target, target + plane_size, T(float(node->getNextColor() == StateColor::WHITE)));
+
+    // Leaves build their planes on the side, derived from their parent while it is being expanded
+    // On the stack unless the history is deeper than HistoryPlanes, so no pool thread allocates on its first leaf
+    BLOCK* planes;
+    BLOCK stacked[HistoryDepth][BoardSize];
+    static thread_local std::vector<BLOCK> uncached;
+    if (node->temp_data && node->temp_data->history)
+        planes = node->temp_data->history->planes[0];
+    else
     {
-        if (running_node == nullptr)
-        {
-            // Is max number which will never be reached
-            move_history.push_back(index_t(-1));
-        }
+        if (history_depth <= HistoryDepth)
+            planes = stacked[0];
         else
         {
-            move_history.push_back(running_node->getParentAction());
-            running_node = running_node->parent;
+            uncached.resize(history_depth * BoardSize);
+            planes = uncached.data();
         }
+        node->buildHistoryPlanes(planes, node->state);
     }
-    std::reverse(move_history.begin(), move_history.end());
 
-    // Oldest state
-    State* history_state;
+    for (int plane = 0; plane < history_depth; plane++)
+        writePlane(target + (plane + 1) * plane_size, planes + plane * BoardSize);
+}
 
-    // The oldest states of each color
-    torch::Tensor history_white = torch::zeros({BoardSize, BoardSize}, default_tensor_options);
-    torch::Tensor histroy_black = torch::zeros({BoardSize, BoardSize}, default_tensor_options);
-    if (running_node != nullptr)
+void Node::buildHistoryPlanes(BLOCK* planes, const State* source_state)
+{
+    int history_depth = Config::historyDepth();
+    size_t plane_bytes = sizeof(BLOCK) * BoardSize;
+
+    // First plane of each color, the oldest state followed by one plane per history move
+    int index_black = 0;
+    int index_white = history_depth / 2;
+    bool next_white = getNextColor() == StateColor::WHITE;
+
+    // A child is its parents history shifted by one move, parents in graph search can change so they are not trusted
+    HistoryPlanes* parent_history = parent && parent->temp_data && !Config::graphSearch() ? parent->temp_data->history : nullptr;
+    if (parent_history)
     {
-        history_state = running_node->state;
-        for (uint8_t x = 0; x < BoardSize; x++)
-            for (uint8_t y = 0; y < BoardSize; y++)
-            {
-                uint8_t cell_value = history_state->getCellValue(x, y);
-                if (cell_value == 0)
-                    histroy_black[x][y] = true;
-                else if (cell_value == 1)
-                    history_white[x][y] = true;
-            }
+        // The parents oldest history move was made by the same color as the move to this node and joins the oldest state
+        int count = history_depth / 2;
+        int mover = next_white ? index_black : index_white;
+        int other = next_white ? index_white : index_black;
+        const BLOCK* parent_planes = parent_history->planes[0];
+
+        memcpy(planes + other * BoardSize, parent_planes + other * BoardSize, plane_bytes * count);
+        memcpy(planes + mover * BoardSize, parent_planes + (mover + 1) * BoardSize, plane_bytes * (count - 1));
+
+        BLOCK* newest = planes + (mover + count - 1) * BoardSize;
+        memcpy(newest, parent_planes + (mover + count - 1) * BoardSize, plane_bytes);
+
+        uint8_t x, y;
+        Utils::indexToCords(getParentAction(), x, y);
+        newest[x] |= BLOCK(1) << y;
+
+        #ifdef DEBUG_CHECK_HISTORY_PLANES
+        BLOCK walked[HistoryDepth][BoardSize];
+        walkHistoryPlanes(walked[0], source_state);
+        if (memcmp(planes, walked[0], plane_bytes * history_depth) != 0)
+            Log::log(LogLevel::ERROR, "Derived history planes differ from the planes of the move history", "NODE");
+        #endif
+        return;
     }
 
-    // Indecies into tensor for color
-    uint8_t index_black = 1;
-    uint8_t index_white = Config::historyDepth() / 2 + 1;
+    walkHistoryPlanes(planes, source_state);
+}
 
-    tensor[index_black] = histroy_black.clone();
-    tensor[index_white] = history_white.clone();
+void Node::walkHistoryPlanes(BLOCK* planes, const State* source_state)
+{
+    int history_depth = Config::historyDepth();
+    int history_moves = history_depth - 2;
+    size_t plane_bytes = sizeof(BLOCK) * BoardSize;
+
+    // First plane of each color, the oldest state followed by one plane per history move
+    int index_black = 0;
+    int index_white = history_depth / 2;
+    bool next_white = getNextColor() == StateColor::WHITE;
+
+    // Oldest history move is at position 0, white did it if (position is even) == next_white
+    auto is_white_move = [&](int position) { return (position % 2 == 0) == next_white; };
+
+    // Collect the history moves per color, moves before the root are index_t(-1)
+    BLOCK recent[2][BoardSize] = {};
+    Node* running_node = this;
+    for (int i = 0; i < history_moves; i++)
+    {
+        if (running_node == nullptr)
+            break;
 
-    // Init toggle for what color did what action
-    bool color_toggle = current_state->getNextColor() == StateColor::WHITE ? true : false;
+        index_t history_move = running_node->getParentAction();
+        if (history_move != index_t(-1))
+        {
+            uint8_t x, y;
+            Utils::indexToCords(history_move, x, y);
+            recent[is_white_move(history_moves - 1 - i)][x] |= BLOCK(1) << y;
+        }
+        running_node = running_node->parent;
+    }
+
+    // Stateless leaves without planes on their parent replay their position, unless the history reaches back to the start of the game
+    std::optional<State> replayed;
+    if (running_node && source_state == nullptr)
+        source_state = &replayed.emplace(replayState());
+
+    // The oldest states of each color, ancestors may not keep their state so take the current one without the history moves
+    // Rows then get the history moves back, which are removed again from newest to oldest while copying their planes
+    BLOCK rows[2][BoardSize];
+    for (int color = 0; color < 2; color++)
+        for (int x = 0; x < BoardSize; x++)
+        {
+            BLOCK base = running_node ? source_state->v_array[color][x] & ~(recent[0][x] | recent[1][x]) : 0;
+            rows[color][x] = base | recent[color][x];
+        }
 
-    // Embed histroy actions
-    for (index_t history_move : move_history)
+    running_node = this;
+    for (int i = 0; i < history_moves; i++)
     {
-        // If white did HM
-        if (color_toggle)
+        int position = history_moves - 1 - i;
+        bool white = is_white_move(position);
+        BLOCK* plane = planes + ((white ? index_white : index_black) + position / 2 + 1) * BoardSize;
+
+        index_t history_move = index_t(-1);
+        if (running_node)
         {
-            index_white++;
-            if (history_move != index_t(-1))
-            {
-                uint8_t x, y;
-                Utils::indexToCords(history_move, x, y);
-                history_white[x][y] = true;
-                tensor[index_white] = history_white.clone();
-            }
+            history_move = running_node->getParentAction();
+            running_node = running_node->parent;
         }
-        // If black did HM
-        else
+
+        if (history_move == index_t(-1))
         {
-            index_black++;
-            if (history_move != index_t(-1))
-            {
-                uint8_t x, y;
-                Utils::indexToCords(history_move, x, y);
-                histroy_black[x][y] = true;
-                tensor[index_black] = histroy_black.clone();
-            }
+            // Moves before the game started stay empty
+            memset(plane, 0, plane_bytes);
+            continue;
         }
 
-        color_toggle = !color_toggle;
+        memcpy(plane, rows[white], plane_bytes);
+
+        uint8_t x, y;
+        Utils::indexToCords(history_move, x, y);
+        rows[white][x] &= ~(BLOCK(1) << y);
+    }
+
+    memcpy(planes + index_black * BoardSize, rows[0], plane_bytes);
+    memcpy(planes + index_white * BoardSize, rows[1], plane_bytes);
+}
+
+State Node::replayState()
+{
+    // The current node of a tree always keeps its state, so the walk ends at the latest there
+    index_t moves[BoardSize * BoardSize];
+    int count = 0;
+    Node* ancestor = this;
+    while (!ancestor->state && ancestor->parent)
+    {
+        moves[count++] = ancestor->move;
+        ancestor = ancestor->parent;
     }
 
-    return tensor;
+    if (!ancestor->state)
+    {
+        Log::log(LogLevel::ERROR, "Tried to replay state of node without an ancestor keeping one", "NODE");
+        return State();
+    }
+
+    State replayed(ancestor->state);
+    while (count > 0)
+        replayed.makeMove(moves[--count]);
+    return replayed;
+}
+
+void Node::releaseHistoryPlanes()
+{
+    if (!temp_data)
+        return;
+
+    release(temp_data->history);
+    temp_data->history = nullptr;
 }
 
 // -------------- Analysis Code --------------
@@ -624,11 +1196,12 @@ std::string distribution(Node* current_node, const std::string& type)
             if (parent->state->isCellEmpty(x, y))
             { 
                 bool matched = false;
-                for (Node* child : parent->children)
+                for (size_t i = 0; i < parent->children.size(); i++)
                 {
+                    Node* child = parent->children[i];
                     index_t index;
                     Utils::cordsToIndex(index, x, y);
-                    if (child->getParentAction() == index)
+                    if (parent->child_actions[i] == index)
                     {
                         matched = true;
                         // If this child was the performed action color
@@ -9,6 +9,8 @@
 #include "State.h"
 #include "Model.h"
 #include "Log.h"
+#include "Arena.h"
+#include "AllocationCounter.h"
 
 /*
 Node is a singular element in a Tree, it represents a unique board position.
@@ -16,17 +18,65 @@ Unlike state, it stores various information about the board position relevant fo
 
 It requires a model output for most actions.
 This model output is not calculated on creation since we want to batch model calls.
+
+In tree parallel search (Config::treeParallel) several threads select leaves in the same tree.
+Statistics are then updated atomically, expansion of a node is claimed by a single thread with a CAS
+and edges are published through edge_count into storage reserved up front, so readers never see a reallocation.
 */
 
 
+// Set of moves, bit move % 64 of word move / 64
+typedef std::array<uint64_t, (BoardSize * BoardSize + 63) / 64> MoveMask;
+
+// Policy output restricted to the legal moves of a node, in ascending move order
+// Element size depends on Config::priorScalar, uint8 is quantized relative to the highest prior
+struct CompactPolicy
+{
+    std::vector<uint8_t> data;
+    // Moves covered by data, a moves slot is its rank among them
+    MoveMask legal;
+    torch::ScalarType dtype;
+    float scale;
+
+    void store(const float* policy, const MoveMask& moves);
+    bool isLegal(index_t move);
+    int slot(index_t move);
+    float at(int slot);
+    float get(index_t move);
+};
+
+// Expansion bookkeeping, only allocated once a node is first selected for expansion
+// Until then every legal move of the state is untried
+struct ExpansionData
+{
+    std::bitset<BoardSize * BoardSize> untried;
+    // Untried actions in ascending prior, built lazily, stale entries are skipped
+    std::vector<index_t> order;
+    bool ordered;
+};
+
+// Input history planes as bitboards (oldest state and one plane per history move, black then white),
+// bit y of planes[p][x] is the cell at x, y. Only nodes being expanded keep them, their children derive their planes in O(HistoryDepth)
+struct HistoryPlanes
+{
+    BLOCK planes[HistoryDepth][BoardSize];
+};
+
 // Stores data about a node, which won't be needed in cold tree
 struct NodeData
 {
     uint32_t visits;
-    std::vector<index_t> untried_actions;
+    ExpansionData* expansion;
+    // Built on the first expansion, released once all children are expanded and one of them got its netdata
+    HistoryPlanes* history;
     float evaluation;
     float summed_evaluation;
-    torch::Tensor policy_evaluations;
+    CompactPolicy policy_evaluations;
+
+    // Per edge statistics, parallel to children so selection never touches the children themselves
+    std::vector<float> edge_priors;
+    std::vector<uint32_t> edge_visits;
+    std::vector<float> edge_values;
 };
 
 class Node
@@ -34,12 +84,35 @@ class Node
 public:
     // Permanent Node data
     Node* parent;
+    // In stateless mode only the current node of a tree keeps its state
     State* state;
     std::vector<Node*> children;
+    // Action leading to each child, parallel to children
+    // (In graph search a child can be shared, so its state->last is not always the action from this node)
+    std::vector<index_t> child_actions;
+    // Position in owning parents children and edge arrays
+    index_t parent_edge;
 
 private:
-    // Temporary Node data
+    // Kept from the state, so nodes without one still know where they are
+    index_t move;
+    uint8_t empty;
+    StateResult result;
+    uint64_t hash;
+    // Empty cells of the position
+    MoveMask legal;
+
+    // Set while a thread expands this node
+    std::atomic<bool> expanding;
+    // Set once the thread holding the claim left the node fully expanded, read without claiming
+    std::atomic<bool> fully_expanded;
+    // Edges visible to selection, children and edge arrays can be longer while an expansion is in progress
+    std::atomic<uint16_t> edge_count;
+
+    // Temporary Node data, allocated on the first network output or expansion (nullptr is unvisited or shrunk)
     NodeData* temp_data;
+    // Owner of this nodes memory, nullptr is heap
+    Arena* arena;
 
 public:
     // Interface to data struct
@@ -53,24 +126,38 @@ public:
     // How often node was visited
     uint32_t getVisits();
     // Get untried actions
-    std::vector<index_t>& getUntriedActions();
+    std::vector<index_t> getUntriedActions();
+    // Number of untried actions
+    int getUntriedCount();
     // Deletes temp data
     void shrinkNode();
 
     // Provide model output
-    void setModelOutput(torch::Tensor policy, torch::Tensor value);
+    void setModelOutput(const float* policy, float value);
 
     // Constructors
+    // Nodes with an arena allocate children, states and data from it, children inherit the parents arena
+    Node(State* state, Node* parent, Arena* arena);
     Node(State* state, Node* parent);
     Node(State* state);
     Node();
     ~Node();
 
+    // Frees node through its arena (or heap), recursively frees owned children
+    static void destroy(Node* node);
+
     // Algorithm
     // Auto expand by policy values
-    Node* expand();
+    // Stateless nodes need the running state of the search path, their children are created without a state
+    Node* expand(State* running_state = nullptr);
     // Manual expand with move_index
-    Node* expand(index_t move_index);
+    Node* expand(index_t move_index, State* running_state = nullptr);
+    // Highest policy untried action, index_t(-1) if none
+    index_t getNextAction();
+    // Add an existing node as child reached by action (graph search)
+    void link(index_t action, Node* child);
+    // Make this node the owning parent of one of its children
+    void adopt(Node* child);
     // Evaluation of node according to MCTS
     float getMeanEvaluation();
     // Get this nodes inital policy eval
@@ -80,20 +167,43 @@ public:
     bool isTerminal();
     // Calls backpropagate with value calculation
     void callBackpropagate();
+    // Adds a single evaluation to this node without propagating
+    void addVisit(float eval);
+    // Adds a single evaluation to the edge towards children[edge]
+    void addEdgeVisit(int edge, float eval);
+    // Counts a lost visit through children[edge] for the player choosing it, -1 reverts it
+    void addVirtualLoss(int edge, int count);
+    // Leaf carries virtual loss on its parent chain up to the trees current node (not used in graph search)
+    bool hasVirtualLoss();
+    void setVirtualLoss(bool pending);
+    // Prior of the edge towards children[edge] used in selection
+    float getEdgePrior(int edge);
+    void setEdgePrior(int edge, float prior);
+    // Untried actions and expansion of this node belong to the thread holding the claim (tree parallel search)
+    // Releasing records whether the node is fully expanded, so selection can pass through it without claiming
+    bool claimExpansion();
+    void releaseExpansion();
+    bool isExpansionDone();
 
     // Other
-    // Removes action from untried_actions
+    // Removes action from untried actions
     void removeFromUntried(index_t action);
     // Has node recieved network data
     bool getNetworkStatus();
     // Resets for algorithm
     void reset();
+    // Create the state of a stateless node from its parents state, only done for the current node of a tree
+    void restoreState(State* parent_state);
 
     // Still in active MCTS tree
     bool isShrunk();
 
     // Get parent action by taking prev action from state
     index_t getParentAction();
+    // Action leading from this node to child
+    index_t getActionTo(Node* child);
+    // Index of child in children and edge arrays, -1 if not a child
+    int getEdgeIndex(Node* child);
 
     // Has no untried actions left, if node is shrunk assume fully expanded
     bool isFullyExpanded();
@@ -102,6 +212,8 @@ public:
     Node* absBestChild();
     // Best child for policy
     Node* bestChild();
+    // Index of best child for policy
+    int bestEdge();
 
     // Black is 0, 1 is White, Draw is 2
     StateResult getResult();
@@ -117,6 +229,8 @@ public:
     // Convert node to tensor Gamestate representation
     static torch::Tensor nodeToGamestate(Node* node);
     static torch::Tensor nodeToGamestate(Node* node, torch::ScalarType dtype);
+    // Write the gamestate planes straight from the bitboards into target, (HistoryDepth + 1) * BoardSize * BoardSize elements of dtype
+    static void writeGamestate(Node* node, void* target, torch::ScalarType dtype);
     static std::string sliceNodeHistory(Node* node, uint8_t depth);
 
     // Get moves that lead to this node
@@ -125,16 +239,41 @@ public:
     // Next player color
     StateColor getNextColor();
 
+    // Position hash with the last HistoryDepth - 2 moves folded in, matches what nodeToGamestate encodes
+    uint64_t getHistoryHash();
+
 private:
     // Get value from policy out tensor
     float getPolicyValue(index_t move);
+    template <typename T>
+    static void writeGamestatePlanes(Node* node, T* target);
+    // Fill HistoryDepth planes, from the parents cached planes or by walking the parents, source_state is the state of this node (nullptr for stateless nodes)
+    void buildHistoryPlanes(BLOCK* planes, const State* source_state);
+    void walkHistoryPlanes(BLOCK* planes, const State* source_state);
+    // State of a stateless node, its moves replayed on the nearest ancestor keeping a state
+    State replayState();
+    void releaseHistoryPlanes();
+    // Appends a new child with its edge statistics and publishes it to selection
+    void addEdge(index_t action, Node* child);
     // Has network data or not
     bool network_status;
+    bool virtual_loss;
+    // Temp data was freed for good
+    bool shrunk;
     // Gets called when network data is recieved
     void backpropagate(float eval);
     // Figures out what to do with the valHeads output
     float valueProcessor(float normalized_value);
-    // Delete state when fully expanded, wont be needed since the "running state",
-    // gets propagated down in expand and its for sure save in one of the lower nodes
-    void deleteState();
+    // Allocates temp data on first use
+    NodeData* getData();
+    // Allocates expansion data on first use
+    ExpansionData* getExpansionData();
+    // Frees temp data including expansion data
+    void releaseData();
+
+    // Arena aware allocation
+    template <typename T, typename... Args>
+    T* allocate(Args&&... args);
+    template <typename T>
+    void release(T* object);
 };
\ No newline at end of file
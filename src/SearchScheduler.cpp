@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "SearchScheduler.h"
+
+bool SearchTask::FinalAwaiter::await_ready() noexcept
+{
+    return false;
+}
+
+void SearchTask::FinalAwaiter::await_suspend(Handle handle) noexcept
+{
+    SearchScheduler* scheduler = handle.promise().scheduler;
+    std::exception_ptr exception = handle.promise().exception;
+    handle.destroy();
+    scheduler->finish(exception);
+}
+
+void SearchTask::FinalAwaiter::await_resume() noexcept
+{
+}
+
+SearchTask SearchTask::promise_type::get_return_object()
+{
+    return SearchTask(Handle::from_promise(*this));
+}
+
+std::suspend_always SearchTask::promise_type::initial_suspend() noexcept
+{
+    return {};
+}
+
+SearchTask::FinalAwaiter SearchTask::promise_type::final_suspend() noexcept
+{
+    return {};
+}
+
+void SearchTask::promise_type::return_void()
+{
+}
+
+void SearchTask::promise_type::unhandled_exception()
+{
+    // Search is finished either way, so the scheduler does not wait on it forever
+    exception = std::current_exception();
+}
+
+SearchTask::SearchTask(Handle handle)
+    : handle(handle)
+{
+}
+
+SearchTask::SearchTask(SearchTask&& other)
+    : handle(other.handle)
+{
+    other.handle = nullptr;
+}
+
+SearchTask::~SearchTask()
+{
+    // Never spawned
+    if (handle)
+        handle.destroy();
+}
+
+SearchTask::Handle SearchTask::release()
+{
+    Handle released = handle;
+    handle = nullptr;
+    return released;
+}
+
+SearchScheduler::SearchScheduler()
+    : ready_head(0), ready_count(0), active(0)
+{
+}
+
+SearchScheduler::~SearchScheduler()
+{
+    if (active != 0)
+        Log::log(LogLevel::ERROR, "Scheduler destroyed with " + std::to_string(active) + " unfinished search(es)", "SCHEDULER");
+}
+
+void SearchScheduler::spawn(SearchTask task)
+{
+    SearchTask::Handle handle = task.release();
+    handle.promise().scheduler = this;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active++;
+
+        // Only grows while spawning, so resuming searches never allocates
+        if (ready.size() < size_t(active))
+        {
+            std::vector<std::coroutine_handle<>> grown(std::max<size_t>(16, ready.size() * 2));
+            for (size_t i = 0; i < ready_count; i++)
+                grown[i] = ready[(ready_head + i) % ready.size()];
+            ready.swap(grown);
+            ready_head = 0;
+        }
+    }
+    schedule(handle);
+}
+
+void SearchScheduler::schedule(std::coroutine_handle<> handle)
+{
+    // Notify under the lock, the last search can finish and free the scheduler right after unlocking
+    std::lock_guard<std::mutex> lock(mutex);
+    ready[(ready_head + ready_count++) % ready.size()] = handle;
+    ready_cv.notify_one();
+}
+
+void SearchScheduler::run()
+{
+    while (true)
+    {
+        std::coroutine_handle<> handle;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready_cv.wait(lock, [&]() { return ready_count != 0 || active == 0; });
+            if (ready_count == 0)
+                return;
+
+            handle = ready[ready_head];
+            ready_head = (ready_head + 1) % ready.size();
+            ready_count--;
+        }
+
+        // Runs until the search awaits the network or finishes, it may already be resumed elsewhere afterwards
+        handle.resume();
+    }
+}
+
+void SearchScheduler::rethrowFailure()
+{
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exception = failure;
+    }
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+void SearchScheduler::finish(std::exception_ptr exception)
+{
+    bool done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (exception && !failure)
+        {
+            failure = exception;
+            Log::log(LogLevel::ERROR, "Search failed, remaining searches still finish", "SCHEDULER");
+        }
+        done = --active == 0;
+    }
+
+    if (done)
+        ready_cv.notify_all();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "Config.h"
+#include "Log.h"
+
+/*
+Runs tree searches as coroutines (Config::coroutineSearch).
+A search suspends while its leaves are in the model and gets scheduled again by the inference server once they are done,
+so far more searches than threads are in flight and no search waits for a whole round of other searches.
+
+Threads calling run resume ready searches until every spawned search is finished.
+A search that throws still finishes, its exception is rethrown by rethrowFailure once all threads left run.
+*/
+
+class SearchScheduler;
+
+// Coroutine of one search, starts suspended until spawned on a scheduler
+class SearchTask
+{
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    // Frees the coroutine and tells the scheduler, nothing of the task is touched afterwards
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept;
+        void await_suspend(Handle handle) noexcept;
+        void await_resume() noexcept;
+    };
+
+    struct promise_type
+    {
+        SearchScheduler* scheduler = nullptr;
+        // Set if the search threw, handed to the scheduler when it finishes
+        std::exception_ptr exception;
+
+        SearchTask get_return_object();
+        std::suspend_always initial_suspend() noexcept;
+        FinalAwaiter final_suspend() noexcept;
+        void return_void();
+        void unhandled_exception();
+    };
+
+    SearchTask(Handle handle);
+    SearchTask(SearchTask&& other);
+    SearchTask(const SearchTask&) = delete;
+    ~SearchTask();
+
+    // Hands the coroutine over to a scheduler
+    Handle release();
+
+private:
+    Handle handle;
+};
+
+class SearchScheduler
+{
+public:
+    SearchScheduler();
+    ~SearchScheduler();
+
+    void spawn(SearchTask task);
+    // Queue a suspended search for resumption, safe from any thread
+    void schedule(std::coroutine_handle<> handle);
+    // Resume searches until all are finished
+    void run();
+    // Rethrows the exception of the first failed search, if any
+    void rethrowFailure();
+
+    // Called by finished searches, exception is null unless the search failed
+    void finish(std::exception_ptr exception);
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready_cv;
+    // Ring of ready searches, every search is queued at most once so it never outgrows the spawned count
+    std::vector<std::coroutine_handle<>> ready;
+    size_t ready_head;
+    size_t ready_count;
+    // Spawned searches not finished yet
+    int active;
+    std::exception_ptr failure;
+};
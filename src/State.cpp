@@ -5,22 +5,50 @@
 
 #include "State.h"
 
+// Keys are derived from a fixed seed so hashes are stable across runs
+static constexpr uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static constexpr std::array<uint64_t, 2 * BoardSize * BoardSize> generateZobristTable()
+{
+    std::array<uint64_t, 2 * BoardSize * BoardSize> table{};
+    for (size_t i = 0; i < table.size(); i++)
+        table[i] = splitmix64(i);
+    return table;
+}
+
+static constexpr std::array<uint64_t, 2 * BoardSize * BoardSize> zobrist_table = generateZobristTable();
+
 State::State()
-    : last(0), empty(BoardSize * BoardSize), result(StateResult::NONE)
+    : last(0), empty(BoardSize * BoardSize), hash(0), result(StateResult::NONE)
 {
     memset(m_array, 0, sizeof(BLOCK) * BoardSize);
     memset(c_array, 0, sizeof(BLOCK) * BoardSize);
+    memset(v_array, 0, sizeof(v_array));
+    memset(d_array, 0, sizeof(d_array));
+    memset(a_array, 0, sizeof(a_array));
 }
 
 State::State(State* source)
-    : last(source->last), empty(source->empty), result(source->result)
+    : last(source->last), empty(source->empty), hash(source->hash), result(source->result)
 {
     memcpy(m_array, source->m_array, sizeof(BLOCK) * BoardSize);
     memcpy(c_array, source->c_array, sizeof(BLOCK) * BoardSize);
+    memcpy(v_array, source->v_array, sizeof(v_array));
+    memcpy(d_array, source->d_array, sizeof(d_array));
+    memcpy(a_array, source->a_array, sizeof(a_array));
 }
 
 void State::makeMove(index_t index)
 {
+    // Color of the player making this move
+    uint8_t color = getNextColor() == StateColor::BLACK ? 0 : 1;
+
     --empty;
     last = index;
     BLOCK x, y;
@@ -29,11 +57,18 @@ void State::makeMove(index_t index)
     // Horizontal
     m_array[y] |= (BLOCK(1) << x);
 
+    hash ^= zobristKey(color, index);
+
+    // Rotated boards only ever store the movers stones, so no flip needed
+    v_array[color][x] |= (BLOCK(1) << y);
+    d_array[color][x - y + BoardSize - 1] |= (BLOCK(1) << x);
+    a_array[color][x + y] |= (BLOCK(1) << x);
+
     // Flip Colors
     for (index_t i = 0; i < BoardSize; i++) c_array[i] ^= m_array[i];
 
     // Check for 5-Stone alignment
-    bool is_won = checkForWin();
+    bool is_won = checkForWin(color);
     if (is_won)
     {
         switch (getNextColor())
@@ -83,11 +118,6 @@ int8_t State::getCellValue(uint8_t x, uint8_t y)
     return -1;
 }
 
-bool State::cellIsActiveColor(int x, int y)
-{
-    return (c_array[y] & (BLOCK(1) << x));
-}
-
 StateColor State::getNextColor()
 {
     if (empty % 2)
@@ -95,6 +125,27 @@ StateColor State::getNextColor()
     return StateColor::WHITE;
 }
 
+uint64_t State::getHash()
+{
+    return hash;
+}
+
+uint64_t State::peekHash(index_t index)
+{
+    return hash ^ zobristKey(getNextColor() == StateColor::BLACK ? 0 : 1, index);
+}
+
+uint64_t State::zobristKey(uint8_t color, index_t index)
+{
+    return zobrist_table[color * BoardSize * BoardSize + index];
+}
+
+uint64_t State::historyKey(int depth, index_t move)
+{
+    // Offset past the stone keys, index_t(-1) gets its own slot per depth
+    return splitmix64(2 * BoardSize * BoardSize + uint64_t(depth) * (BoardSize * BoardSize + 1) + (move == index_t(-1) ? BoardSize * BoardSize : move));
+}
+
 StateResult State::getResult()
 {
     return result;
@@ -156,71 +207,27 @@ std::string State::toString()
     return result.str();
 }
 
-bool State::checkForWin()
+bool State::hasFive(BLOCK line)
+{
+    line = line & (line >> BLOCK(1));
+    line = line & (line >> BLOCK(2));
+    return line & (line >> BLOCK(1));
+}
+
+bool State::checkForWin(uint8_t color)
 {
     uint8_t x, y;
     Utils::indexToCords(last, x, y);
 
-    //Horizontal
-    // This is still performant since it uses the original code for the check
-    BLOCK m = c_array[y];
-    m = m & (m >> BLOCK(1));
-    m = (m & (m >> BLOCK(2)));
-    if (m & (m >> BLOCK(1))) return true;
-
-    // We are no longer storing representations of all directions, so this will be slow
-
-    //Vertical
-    int consecutive = 0;
-    for (int i = 0; i < BoardSize; i++)
-    {
-        if (cellIsActiveColor(x, i))
-        {
-            consecutive++;
-            if (consecutive == 5) return true;
-        }
-        else consecutive = 0;
-    }
-
-    //Diagonal
-    consecutive = 0;
-    int x1 = x, y1 = y;
-    while (x1 > 0 && y1 > 0)
-    {
-        x1--;
-        y1--;
-    }
-    while (x1 < BoardSize && y1 < BoardSize)
-    {
-        if (cellIsActiveColor(x1, y1))
-        {
-            consecutive++;
-            if (consecutive == 5) return true;
-        }
-        else consecutive = 0;
-        x1++;
-        y1++;
-    }
-
-    //Anti-Diagonal
-    consecutive = 0;
-    x1 = x, y1 = y;
-    while (x1 > 0 && y1 < BoardSize - 1)
-    {
-        x1--;
-        y1++;
-    }
-    while (x1 < BoardSize && y1 >= 0)
-    {
-        if (cellIsActiveColor(x1, y1))
-        {
-            consecutive++;
-            if (consecutive == 5) return true;
-        }
-        else consecutive = 0;
-        x1++;
-        y1--;
-    }
+    // Every direction is stored as its own bitboard, so all use the same shift test
+    // Horizontal
+    if (hasFive(c_array[y])) return true;
+    // Vertical
+    if (hasFive(v_array[color][x])) return true;
+    // Diagonal
+    if (hasFive(d_array[color][x - y + BoardSize - 1])) return true;
+    // Anti-Diagonal
+    if (hasFive(a_array[color][x + y])) return true;
 
     return false;
 }
@@ -51,8 +51,17 @@ public:
     BLOCK m_array[BoardSize];
     // Color
     BLOCK c_array[BoardSize];
+    // Rotated stones per color (0 is black 1 is white), bit x of each line is the stone at x
+    // Vertical (transposed), indexed by x with bit y
+    BLOCK v_array[2][BoardSize];
+    // Diagonal, indexed by x - y + BoardSize - 1
+    BLOCK d_array[2][BoardSize * 2 - 1];
+    // Anti-Diagonal, indexed by x + y
+    BLOCK a_array[2][BoardSize * 2 - 1];
     // Last is last played move, empty is remaining empty fields
     index_t last, empty;
+    // Zobrist key of the stones on the board
+    uint64_t hash;
 
     State();
     State(State*);
@@ -76,9 +85,19 @@ public:
 
     StateColor getNextColor();
 
+    // Zobrist key of the stones on the board, next color is implied by stone count
+    uint64_t getHash();
+    // Hash after a move at index, without making it
+    uint64_t peekHash(index_t index);
+    // Key for a stone of color (0 is black 1 is white) at index
+    static uint64_t zobristKey(uint8_t color, index_t index);
+    // Key for move at depth moves back in history, index_t(-1) for moves before the game started
+    static uint64_t historyKey(int depth, index_t move);
+
 private:
     StateResult result;
 
-    bool checkForWin();
-    bool cellIsActiveColor(int x, int y);
+    bool checkForWin(uint8_t color);
+    // Five consecutive bits in line
+    static bool hasFive(BLOCK line);
 };
\ No newline at end of file
@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int workers)
+    : worker_count(std::max(0, workers)), pending(0), running(true)
+{
+    queues = new WorkerQueue[std::max(1, worker_count)];
+
+    threads.reserve(worker_count);
+    for (int i = 0; i < worker_count; i++)
+        threads.emplace_back(&ThreadPool::worker, this, i);
+
+    Log::log(LogLevel::INFO, "Started " + std::to_string(worker_count) + " pool worker(s)", "POOL");
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        running.store(false);
+    }
+    sleep_cv.notify_all();
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    delete[] queues;
+}
+
+int ThreadPool::getWorkerCount()
+{
+    return worker_count;
+}
+
+void ThreadPool::run(int count, int grain, TaskFunction function)
+{
+    if (count <= 0)
+        return;
+
+    grain = std::max(1, grain);
+
+    // Nothing to share
+    if (worker_count == 0 || count <= grain)
+    {
+        function.call(function.object, 0, count);
+        return;
+    }
+
+    TaskGroup group;
+    int chunks = (count + grain - 1) / grain;
+    group.remaining.store(chunks);
+
+    // Spread chunks round robin, stealing evens out the rest
+    for (int chunk = 0; chunk < chunks; chunk++)
+    {
+        Task task = {function, chunk * grain, std::min(count, (chunk + 1) * grain), &group};
+        WorkerQueue& queue = queues[chunk % worker_count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        pending.fetch_add(chunks);
+    }
+    sleep_cv.notify_all();
+
+    // Help until the own group is finished
+    while (group.remaining.load() > 0)
+    {
+        if (runTask(-1))
+            continue;
+
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&]() { return group.remaining.load() == 0; });
+    }
+}
+
+void ThreadPool::worker(int id)
+{
+    while (true)
+    {
+        if (runTask(id))
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleep_cv.wait(lock, [&]() { return pending.load() > 0 || !running.load(); });
+        if (!running.load() && pending.load() == 0)
+            return;
+    }
+}
+
+bool ThreadPool::runTask(int id)
+{
+    Task task;
+    if (!popTask(id, task) && !stealTask(id, task))
+        return false;
+
+    pending.fetch_sub(1);
+    task.function.call(task.function.object, task.begin, task.end);
+
+    // Last chunk of a group wakes up its submitter
+    if (task.group->remaining.fetch_sub(1) == 1)
+    {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        done_cv.notify_all();
+    }
+    return true;
+}
+
+bool ThreadPool::popTask(int id, Task& task)
+{
+    if (id < 0)
+        return false;
+
+    WorkerQueue& queue = queues[id];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.size() == queue.head)
+        return false;
+
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    if (queue.tasks.size() == queue.head)
+    {
+        queue.tasks.clear();
+        queue.head = 0;
+    }
+    return true;
+}
+
+bool ThreadPool::stealTask(int id, Task& task)
+{
+    for (int offset = 1; offset <= worker_count; offset++)
+    {
+        int victim = (std::max(id, 0) + offset) % worker_count;
+        if (victim == id)
+            continue;
+
+        WorkerQueue& queue = queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.size() == queue.head)
+            continue;
+
+        task = queue.tasks[queue.head++];
+        if (queue.tasks.size() == queue.head)
+        {
+            queue.tasks.clear();
+            queue.head = 0;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+/**
+ * Copyright (c) Alexander Kurtz 2023
+*/
+
+
+#include "Config.h"
+#include "Log.h"
+
+/*
+Work stealing pool shared by all threaded stages of a batcher (gamestate conversion and simulations).
+Work is submitted as a range split into small chunks, which get spread over the worker queues.
+Workers take from the back of their own queue and steal from the front of other queues once it runs dry,
+so uneven chunks (trees of very different sizes) never leave threads idle while work is left.
+
+The submitting thread works on chunks as well, several threads can submit at the same time.
+*/
+
+// Outstanding chunks of one parallelFor call
+struct TaskGroup
+{
+    std::atomic<int> remaining;
+};
+
+// Non owning reference to the callable of a parallelFor, so submitting work does not allocate
+struct TaskFunction
+{
+    void* object;
+    void (*call)(void* object, int begin, int end);
+};
+
+struct Task
+{
+    TaskFunction function;
+    int begin;
+    int end;
+    TaskGroup* group;
+};
+
+// Own cache line per worker, so queue accesses of different workers never share one
+// Tasks before head were stolen, the storage is reused once the queue runs empty
+struct alignas(64) WorkerQueue
+{
+    std::mutex mutex;
+    std::vector<Task> tasks;
+    size_t head = 0;
+};
+
+class ThreadPool
+{
+public:
+    // Number of workers besides the submitting thread, 0 runs everything on the caller
+    ThreadPool(int workers);
+    ~ThreadPool();
+
+    // Calls function(begin, end) for chunks of at most grain elements covering [0, count), returns when all are done
+    template <typename Function>
+    void parallelFor(int count, int grain, Function&& function)
+    {
+        TaskFunction task_function = {
+            static_cast<void*>(&function),
+            [](void* object, int begin, int end) { (*static_cast<std::remove_reference_t<Function>*>(object))(begin, end); }
+        };
+        run(count, grain, task_function);
+    }
+
+    int getWorkerCount();
+
+private:
+    // Splits [0, count) into tasks and helps until they are done
+    void run(int count, int grain, TaskFunction function);
+    void worker(int id);
+    // Own queue first (id == -1 has none), then steal, returns if a task was run
+    bool runTask(int id);
+    bool popTask(int id, Task& task);
+    bool stealTask(int id, Task& task);
+
+    std::vector<std::thread> threads;
+    WorkerQueue* queues;
+    int worker_count;
+
+    // Tasks in queues, workers sleep while 0
+    std::atomic<int> pending;
+    std::atomic<bool> running;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+
+    // Submitters wait here for their group once nothing is left to steal
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+};
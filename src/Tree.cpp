@@ -6,23 +6,52 @@
 #include "Tree.h"
 
 Tree::Tree()
+    : Tree(-1)
+{   }
+
+Tree::Tree(int seed)
+    : queued_path_count(0), rng(seed != -1 ? new std::mt19937(seed) : nullptr)
 {
-    root_node = new Node();
+    arena = new Arena(Config::hugePages());
+    root_node = arena->create<Node>(arena->create<State>(), nullptr, arena);
     network_queue.push_back(root_node);
     current_node = root_node;
+    if (rng)
+        sampleRootNoise();
+
+    if (Config::graphSearch())
+        transposition_table[root_node->state->getHash()] = root_node;
 }
 
 Tree::~Tree()
 {
-    // Will recursively delete all nodes
-    delete root_node;
+    if (Config::graphSearch())
+    {
+        // Table holds every node exactly once, so delete without recursion
+        for (auto& [hash, node] : transposition_table)
+        {
+            node->children.clear();
+            Node::destroy(node);
+        }
+    }
+    else
+    {
+        // Will recursively delete all nodes
+        Node::destroy(root_node);
+    }
+
+    // Chunks are released in bulk
+    delete arena;
+    delete rng;
 }
 
 void nodeCrawler(std::vector<Node*>& node_vector, Node* node)
 {
     node_vector.push_back(node);
+    // Only follow owned children so shared nodes are visited once
     for (Node* child : node->children)
-        nodeCrawler(node_vector, child);
+        if (child->parent == node)
+            nodeCrawler(node_vector, child);
 }
 
 void Tree::updateCurrentNode(index_t action)
@@ -34,11 +63,11 @@ void Tree::updateCurrentNode(index_t action)
     State* current_state = current_node->state;
 
     // Put all other children in deletion queue and try to find matching child
-    for (Node* child : current_node->children)
-        if (child->getParentAction() != action)
-            deletion_queue.push_back(child);
+    for (size_t i = 0; i < current_node->children.size(); i++)
+        if (current_node->child_actions[i] != action)
+            deletion_queue.push_back(current_node->children[i]);
         else
-            chosen_child = child;
+            chosen_child = current_node->children[i];
 
     // We check for if node exists first, if it does the field will be alloctated
     if (!current_state->isCellEmpty(x, y) && chosen_child == nullptr)
@@ -50,22 +79,74 @@ void Tree::updateCurrentNode(index_t action)
     // Node does not have desired child
     if (chosen_child == nullptr)
     {
-        // Expand to move index
-        chosen_child = current_node->expand(action);
+        if (Config::graphSearch())
+        {
+            bool created;
+            chosen_child = graphExpand(current_node, action, created);
+            if (created)
+                network_queue.push_back(chosen_child);
+        }
+        else
+        {
+            // Expand to move index
+            chosen_child = current_node->expand(action);
 
-        // Push the new node into the network queue
-        network_queue.push_back(chosen_child);
+            // Push the new node into the network queue
+            network_queue.push_back(chosen_child);
+        }
     }
 
+    // A shared node becomes owned by the node the game actually passed through
+    if (chosen_child->parent != current_node)
+        current_node->adopt(chosen_child);
+
     if (current_node->parent)
         current_node->parent->shrinkNode();
 
+    // The current node always keeps its state
+    chosen_child->restoreState(current_node->state);
+
     current_node = chosen_child;
 
     if (Config::noCache())
     {
         current_node->reset();
     }
+
+    // Children searched during the last move only had plain priors
+    if (rng && !current_node->isShrunk())
+    {
+        sampleRootNoise();
+        for (size_t i = 0; i < current_node->children.size(); i++)
+            perturbRootEdge(i);
+    }
+}
+
+void Tree::sampleRootNoise()
+{
+    // Normalized gamma samples over every legal move are one Dirichlet sample
+    std::gamma_distribution<float> gamma(Config::rootTreeNoiseAlpha(), 1.0f);
+    State* state = current_node->state;
+    float sum = 0.0f;
+    for (index_t i = 0; i < BoardSize * BoardSize; i++)
+    {
+        root_noise[i] = state->isCellEmpty(i) ? gamma(*rng) : 0.0f;
+        sum += root_noise[i];
+    }
+
+    if (sum <= 0.0f)
+        return;
+    for (float& noise : root_noise)
+        noise /= sum;
+}
+
+void Tree::perturbRootEdge(int edge)
+{
+    // Edges get created one by one, but their noise comes from the sample of the whole root
+    float noise = root_noise[current_node->child_actions[edge]];
+    float prior = current_node->getEdgePrior(edge);
+    float weight = Config::rootTreeNoise();
+    current_node->setEdgePrior(edge, (1.0f - weight) * prior + weight * noise);
 }
 
 void Tree::collapseTree()
@@ -73,12 +154,13 @@ void Tree::collapseTree()
     if (!current_node->isTerminal())
         Log::log(LogLevel::WARNING, "Collapsing non terminal tree!", "TREE");
 
-    for (Node* child : current_node->children)
-    {
-        delete child;
-    }
+    // In graph search nodes are freed with the tree
+    if (!Config::graphSearch())
+        for (Node* child : current_node->children)
+            Node::destroy(child);
 
     current_node->children.clear();
+    current_node->child_actions.clear();
 
     // Shrink last remaining nodes
     if (!current_node->isShrunk())
@@ -133,53 +215,292 @@ bool Tree::makeMove(uint8_t x, uint8_t y)
     return true;
 }
 
-Node* Tree::policy()
+Node* Tree::policy(bool virtual_loss)
 {
-    // Policy loop
+    if (Config::graphSearch())
+        return graphPolicy(virtual_loss);
+
+    // Stateless nodes get their state replayed along the path
+    std::optional<State> running_state;
+    bool stateless = Config::statelessNodes();
+    if (stateless)
+        running_state.emplace(current_node->state);
+
+    bool parallel = Config::treeParallel();
+
+    // Policy loop, virtual loss is added to every edge as soon as it is selected
     Node* current = current_node;
+    while (!current->isTerminal())
+    {
+        // Only expansion is claimed, fully expanded nodes are passed through without touching the flag
+        if (parallel ? !current->isExpansionDone() : !current->isFullyExpanded())
+        {
+            // Another thread is expanding this node, look again once it is done
+            if (parallel && !current->claimExpansion())
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // The last untried action can have been taken before the claim
+            if (!parallel || !current->isFullyExpanded())
+            {
+                Node* new_node = current->expand(stateless ? &*running_state : nullptr);
+                if (virtual_loss)
+                {
+                    current->addVirtualLoss(new_node->parent_edge, 1);
+                    new_node->setVirtualLoss(true);
+                }
+                if (parallel)
+                    current->releaseExpansion();
+
+                // Only shared between threads in tree parallel search
+                std::unique_lock<std::mutex> lock(queue_mutex, std::defer_lock);
+                if (parallel)
+                    lock.lock();
+                if (rng && current == current_node)
+                    perturbRootEdge(new_node->parent_edge);
+                network_queue.push_back(new_node);
+                return new_node;
+            }
+
+            current->releaseExpansion();
+        }
+
+        current = current->bestChild();
+        if (virtual_loss)
+            current->parent->addVirtualLoss(current->parent_edge, 1);
+        if (stateless)
+            running_state->makeMove(current->getParentAction());
+
+        // Leaf selected earlier in this round, still waiting for netdata, this descent added nothing
+        if (!current->getNetworkStatus())
+        {
+            if (virtual_loss)
+                applyVirtualLoss(current, -1);
+            return current;
+        }
+    }
+
+    // Terminal leaves are not queued, so their virtual loss goes right away
+    if (virtual_loss)
+        applyVirtualLoss(current, -1);
+
+    // If node already with netdata implies it didnt get backpropagated so we manually call it again
+    if (current->getNetworkStatus())
+        current->callBackpropagate();
+
+    return current;
+}
+
+Node* Tree::graphExpand(Node* node, index_t action, bool& created)
+{
+    AllocationCounter::Exempt tree_memory;
+    auto it = transposition_table.find(node->state->peekHash(action));
+    if (it != transposition_table.end())
+    {
+        // Reached known position through a different move order
+        created = false;
+        node->link(action, it->second);
+        return it->second;
+    }
+
+    created = true;
+    Node* child = node->expand(action);
+    transposition_table[child->state->getHash()] = child;
+    return child;
+}
+
+void Tree::applyVirtualLoss(std::vector<Node*>& path, int count)
+{
+    for (size_t i = 1; i < path.size(); i++)
+        path[i - 1]->addVirtualLoss(path[i - 1]->getEdgeIndex(path[i]), count);
+}
+
+void Tree::applyVirtualLoss(Node* leaf, int count)
+{
+    for (Node* node = leaf; node != current_node; node = node->parent)
+        node->parent->addVirtualLoss(node->parent_edge, count);
+}
+
+Node* Tree::graphPolicy(bool virtual_loss)
+{
+    // Nodes visited in this simulation, shared nodes have no unique parent chain
+    // Every move fills a cell, so no path is longer than the board, sized once so deeper searches never grow it
+    std::vector<Node*>& path = policy_path;
+    path.reserve(BoardSize * BoardSize + 1);
+    path.clear();
+    Node* current = current_node;
+    path.push_back(current);
+
     while (!current->isTerminal())
     {
         if (!current->isFullyExpanded())
         {
-            Node* new_node = current->expand();
-            network_queue.push_back(new_node);
-            return new_node;
+            bool created;
+            current = graphExpand(current, current->getNextAction(), created);
+            path.push_back(current);
+
+            if (created)
+            {
+                network_queue.push_back(current);
+                if (queued_path_count == queued_paths.size())
+                {
+                    queued_paths.emplace_back();
+                    queued_paths.back().nodes.reserve(BoardSize * BoardSize + 1);
+                }
+                QueuedPath& queued = queued_paths[queued_path_count++];
+                queued.leaf = current;
+                queued.nodes.assign(path.begin(), path.end());
+                queued.virtual_loss = virtual_loss;
+                if (virtual_loss)
+                    applyVirtualLoss(path, 1);
+                return current;
+            }
         }
         else
         {
             current = current->bestChild();
+            path.push_back(current);
         }
+
+        // Shared node still waiting for netdata, it gets backpropagated with its own path
+        if (!current->getNetworkStatus())
+            return current;
     }
+
+    // Terminal leaf already has netdata
+    backpropagatePath(path, current->getProcessedEval());
     return current;
 }
 
-std::vector<Node*> Tree::getNetworkQueue()
+int Tree::findQueuedPath(Node* leaf)
+{
+    for (size_t i = 0; i < queued_path_count; i++)
+        if (queued_paths[i].leaf == leaf)
+            return i;
+    return -1;
+}
+
+void Tree::removeQueuedPath(int index)
+{
+    std::swap(queued_paths[index], queued_paths[--queued_path_count]);
+}
+
+void Tree::backpropagatePath(std::vector<Node*>& path, float eval)
+{
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        path[i]->addVisit(eval);
+        if (i > 0)
+            path[i - 1]->addEdgeVisit(path[i - 1]->getEdgeIndex(path[i]), eval);
+    }
+}
+
+void Tree::sweepGraph()
+{
+    // Everything reachable from current node survives, remember who found a node first
+    std::unordered_map<Node*, Node*> reachable;
+    std::vector<Node*> stack;
+    reachable[current_node] = current_node->parent;
+    stack.push_back(current_node);
+    while (!stack.empty())
+    {
+        Node* node = stack.back();
+        stack.pop_back();
+        for (Node* child : node->children)
+            if (reachable.emplace(child, node).second)
+                stack.push_back(child);
+    }
+
+    // Nodes whose owner gets freed are handed to a surviving parent
+    for (auto& [node, discoverer] : reachable)
+        if (node != current_node && reachable.find(node->parent) == reachable.end())
+            discoverer->adopt(node);
+
+    // Played path keeps only the move that was made
+    std::unordered_set<Node*> played;
+    Node* next = current_node;
+    for (Node* node = current_node->parent; node != nullptr; node = node->parent)
+    {
+        for (int i = int(node->children.size()) - 1; i >= 0; i--)
+            if (node->children[i] != next)
+                node->removeNodeFromChildren(node->children[i]);
+        played.insert(node);
+        next = node;
+    }
+
+    for (auto it = transposition_table.begin(); it != transposition_table.end();)
+    {
+        Node* node = it->second;
+        if (played.find(node) != played.end() || reachable.find(node) != reachable.end())
+        {
+            it++;
+            continue;
+        }
+
+        Utils::eraseFromVector(network_queue, node);
+        int path_index = findQueuedPath(node);
+        if (path_index != -1)
+            removeQueuedPath(path_index);
+        node->children.clear();
+        Node::destroy(node);
+        it = transposition_table.erase(it);
+    }
+}
+
+const std::vector<Node*>& Tree::getNetworkQueue()
 {
     return network_queue;
 }
 
 bool Tree::clearNetworkQueue()
 {
-    std::vector<Node*> unsuccessfull;
+    // Nodes still without netdata move to the front, so the queue is compacted in place
+    size_t unsuccessfull = 0;
     for (Node* node : network_queue)
+    {
         if (!node->getNetworkStatus())
-            unsuccessfull.push_back(node);
+        {
+            network_queue[unsuccessfull++] = node;
+            continue;
+        }
 
-    network_queue.clear();
+        if (node->hasVirtualLoss())
+        {
+            applyVirtualLoss(node, -1);
+            node->setVirtualLoss(false);
+        }
 
-    // All queued nodes are sucessfully initialized
-    if (unsuccessfull.size() == 0)
-        return true;
+        // Nodes queued outside of policy have no path
+        int path_index = Config::graphSearch() ? findQueuedPath(node) : -1;
+        if (path_index != -1 && queued_paths[path_index].virtual_loss)
+            applyVirtualLoss(queued_paths[path_index].nodes, -1);
 
-    // Some nodes are still not initialized
-    for (Node* node : unsuccessfull)
-        network_queue.push_back(node);
-    return false;
+        if (Config::graphSearch())
+        {
+            // Nodes queued outside of policy only count for themselves
+            if (path_index != -1)
+            {
+                backpropagatePath(queued_paths[path_index].nodes, node->getProcessedEval());
+                removeQueuedPath(path_index);
+            }
+            else
+                node->addVisit(node->getProcessedEval());
+        }
+    }
+
+    // Some nodes might still not be initialized
+    network_queue.resize(unsuccessfull);
+    return unsuccessfull == 0;
 }
 
 void Tree::forceClearNetworkQueue()
 {
+    for (Node* node : network_queue)
+        node->setVirtualLoss(false);
     network_queue.clear();
+    queued_path_count = 0;
 }
 
 Node* Tree::getCurrentNode()
@@ -196,6 +517,13 @@ Node* Tree::getParentNode()
 
 void Tree::clean()
 {
+    if (Config::graphSearch())
+    {
+        deletion_queue.clear();
+        sweepGraph();
+        return;
+    }
+
     for (Node* garbage : deletion_queue)
     {
         // Delete node from queue
@@ -203,7 +531,7 @@ void Tree::clean()
 
         // Delete child pointer from children list
         garbage->parent->removeNodeFromChildren(garbage);
-        delete garbage;
+        Node::destroy(garbage);
     }
 
     deletion_queue.clear();
@@ -14,24 +14,42 @@
 A Tree is a domain for a singular Node tree, its main purpose is to make environment simpler.
 
 Tree also automatically accumilates a network queue which is a list of nodes still requiring model data.
+
+In graph search (Config::graphSearch) identical positions reached by different move orders share one node.
+The tree then owns all nodes through its transposition table and backpropagates along the selected path instead of parent pointers.
+
+A seeded tree mixes Dirichlet noise into the priors of its current nodes children, so several root trees of one environment diverge.
 */
 
+// Path selected by graph policy for a queued leaf
+struct QueuedPath
+{
+    Node* leaf;
+    std::vector<Node*> nodes;
+    // Virtual loss was applied along the path
+    bool virtual_loss;
+};
+
 class Tree
 {
 public:
     Tree();
+    // Seed -1 is a tree without root noise
+    Tree(int seed);
     ~Tree();
 
     // These functions can/will require a NN computation, those will be stored in network queue
     bool makeMove(uint8_t x, uint8_t y);
     bool makeMove(index_t index);
-    Node* policy();
+    // With virtual loss, several calls can select distinct leaves before the network runs
+    // In tree parallel search (Config::treeParallel) these calls can come from several threads at once
+    Node* policy(bool virtual_loss = false);
     // <-------------------->
 
     Node* getRootNode();
 
     // Network queue managment
-    std::vector<Node*> getNetworkQueue();
+    const std::vector<Node*>& getNetworkQueue();
     bool clearNetworkQueue();
     void forceClearNetworkQueue();
 
@@ -50,8 +68,47 @@ public:
 private:
     void updateCurrentNode(index_t action);
 
+    // Draws the Dirichlet noise over the legal moves of current node
+    void sampleRootNoise();
+    // Mixes noise into the prior of an edge of current node
+    void perturbRootEdge(int edge);
+
+    // Applies (count 1) or reverts (count -1) virtual loss along a selected path
+    void applyVirtualLoss(std::vector<Node*>& path, int count);
+    // Same along the parent chain from leaf up to current node, so no path has to be stored
+    void applyVirtualLoss(Node* leaf, int count);
+
+    // Graph search
+    Node* graphPolicy(bool virtual_loss);
+    // Expands node by action or links the existing node for the resulting position
+    Node* graphExpand(Node* node, index_t action, bool& created);
+    void backpropagatePath(std::vector<Node*>& path, float eval);
+    // Index of the path queued with leaf, -1 if it was queued outside of policy
+    int findQueuedPath(Node* leaf);
+    // Moves the path to the spare entries
+    void removeQueuedPath(int index);
+    // Frees all nodes no longer reachable from current node
+    void sweepGraph();
+
+    // Owns the memory of every node in this tree
+    Arena* arena;
+
     std::vector<Node*> deletion_queue;
     std::vector<Node*> network_queue;
+    // Position hash to node, only used in graph search
+    std::unordered_map<uint64_t, Node*> transposition_table;
+    // Selected paths of queued leaves, only used in graph search
+    // Entries past queued_path_count are spare, so their memory is reused by the next leaves
+    std::vector<QueuedPath> queued_paths;
+    size_t queued_path_count;
+    // Path of the running graph policy call
+    std::vector<Node*> policy_path;
+    // Guards network queue while policy runs on several threads
+    std::mutex queue_mutex;
     Node* root_node;
     Node* current_node;
+    // Root noise, nullptr if disabled
+    std::mt19937* rng;
+    // Noise of every move of current node, sums to 1 over its legal moves
+    std::array<float, BoardSize * BoardSize> root_noise;
 };
\ No newline at end of file
@@ -41,14 +41,16 @@ void TreeVisualizer::traverseAndGenerateCode(Node* node, std::ostream& out, int&
     // Visit each child
     for (Node* child : node->children) {
         // Assign an ID to the child if it doesn't have one
-        if (nodeIds.count(child) == 0) {
+        bool visited = nodeIds.count(child) != 0;
+        if (!visited) {
             nodeIds[child] = nextId++;
         }
 
         // Write the edge to the output
         out << " " << nodeIds[node] << " -> " << nodeIds[child] << ";" << std::endl;
 
-        // Recurse on the child
-        traverseAndGenerateCode(child, out, nextId, nodeIds);
+        // Recurse on the child, shared children in graph search are only written once
+        if (!visited)
+            traverseAndGenerateCode(child, out, nextId, nodeIds);
     }
 }